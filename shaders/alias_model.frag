@@ -1,13 +1,15 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(binding=1) uniform sampler2D tex;
+layout(binding=1) uniform sampler2DArray tex;
 
 layout(location=0) in vec2 inTexCoord;
 
 layout(location=0) out vec4 outColor;
 
+// NOTE(jan): Models are drawn at full brightness, so the fullbright mask in
+// alpha is only used by level textures.
 void main() {
-    vec4 texColor = texture(tex, inTexCoord);
-    outColor = texColor;
+    vec4 texColor = texture(tex, vec3(inTexCoord, 0));
+    outColor = vec4(texColor.rgb, 1);
 }
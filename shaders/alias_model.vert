@@ -3,9 +3,18 @@
 
 #include "uniforms.glsl"
 
-layout(push_constant) uniform PushConstants {
-    vec3 translate;
+// NOTE(jan): See ModelInstance in RenderModel.cpp.
+struct ModelInstance {
+    vec3 origin;
     float angle;
+};
+
+layout(binding=2) readonly buffer ModelInstances {
+    ModelInstance instances[];
+} modelInstances;
+
+layout(push_constant) uniform PushConstants {
+    uint firstInstance;
 } pushConstants;
 
 layout(location=0) in vec3 inPosition;
@@ -14,7 +23,10 @@ layout(location=1) in vec2 inTexCoord;
 layout(location=0) out vec2 outTexCoord;
 
 void main() {
-    float theta = pushConstants.angle * 3.14 / 180;
+    ModelInstance instance = modelInstances.instances[
+        pushConstants.firstInstance + gl_InstanceIndex
+    ];
+    float theta = instance.angle * 3.14 / 180;
     float cs = cos(theta);
     float sn = sin(theta);
     mat4 rotation = mat4(1.0);
@@ -22,7 +34,7 @@ void main() {
     rotation[0][2] = -sn;
     rotation[2][0] = sn;
     rotation[2][2] = cs;
-    vec4 position = vec4(pushConstants.translate, 0) + (rotation * vec4(inPosition, 1.0));
+    vec4 position = vec4(instance.origin, 0) + (rotation * vec4(inPosition, 1.0));
     gl_Position = uniforms.mvp * position;
     outTexCoord = inTexCoord;
 }
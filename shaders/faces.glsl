@@ -0,0 +1,31 @@
+// NOTE(jan): See FaceRecord in Mesh.h.
+struct FaceRecord {
+    vec4 uVector;
+    vec4 vVector;
+    vec4 scale;
+    vec2 lightScale;
+    uint texSlot;
+    uint lightStyles;
+    uint model;
+};
+
+layout(binding=6) readonly buffer FaceRecords {
+    FaceRecord faces[];
+} faceRecords;
+
+// NOTE(jan): One per BSP model, the world's is the identity.
+layout(binding=7) readonly buffer ModelTransforms {
+    mat4 transforms[];
+} modelTransforms;
+
+vec4 faceWorldPosition(FaceRecord face, vec3 position) {
+    return modelTransforms.transforms[face.model] * vec4(position, 1.0);
+}
+
+// NOTE(jan): In texels, before dividing by the texture size.
+vec2 faceTexCoord(FaceRecord face, vec3 position) {
+    return vec2(
+        dot(position, face.uVector.xyz) + face.uVector.w,
+        dot(position, face.vVector.xyz) + face.vVector.w
+    );
+}
@@ -3,14 +3,11 @@
 
 #include "uniforms.glsl"
 
-// TODO(jan): Somehow bind this the the number of textures in the BSP.
-layout(binding=1) uniform sampler2D atlas[200];
+// NOTE(jan): One array per texture size class, see TexturePacker.h.
+layout(binding=1) uniform sampler2DArray textures[32];
 
 layout(location=0) in vec2 inTexCoord;
 layout(location=1) in flat uint inTexIdx;
-layout(location=2) in vec2 inLightCoord;
-layout(location=3) in flat int inLightIdx;
-layout(location=4) in flat vec2 inExtent;
 
 layout(location=0) out vec4 outColor;
 
@@ -28,6 +25,9 @@ void main() {
     texCoord.x = x + amplitude * sin(offset + y);
     texCoord.y = y + amplitude * sin(offset + x);
 
-    vec3 color = texture(atlas[inTexIdx], texCoord).rgb;
+    // NOTE(jan): The same for every fragment of a draw, see Mesh::fluidDraws.
+    uint arrayIdx = inTexIdx >> 16;
+    float layer = float(inTexIdx & 0xFFFF);
+    vec3 color = texture(textures[arrayIdx], vec3(texCoord, layer)).rgb;
     outColor = vec4(color, 1);
 }
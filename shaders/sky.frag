@@ -3,14 +3,23 @@
 
 #include "uniforms.glsl"
 
-// TODO(jan): Somehow bind this the the number of textures in the BSP.
-layout(binding=1) uniform sampler2D atlas[2];
+// NOTE(jan): Maps normally use a single sky texture. Each is a one layer
+// array, see renderLevel.
+layout(binding=1) uniform sampler2DArray skies[4];
 
 layout(location=0) in flat uint inTexIdx;
 layout(location=1) in vec3 inDir;
 
 layout(location=0) out vec4 outColor;
 
+// NOTE(jan): Sky textures hold the front layer in their left half and the back
+// layer in their right half. Wrap within a half and keep away from the seam
+// so filtering doesn't bleed one layer into the other.
+vec2 skyLayerCoord(vec2 texCoord, float layer, float halfTexel) {
+    float s = clamp(fract(texCoord.x), halfTexel, 1.f - halfTexel);
+    return vec2((s + layer) * .5f, texCoord.y);
+}
+
 void main() {
     vec3 dir = inDir;
     dir.y *= 3;
@@ -22,8 +31,12 @@ void main() {
     scroll = scroll / 2.f;
     vec2 texCoordBack = vec2(scroll + dir.x, scroll - dir.z);
 
-    vec3 frontColor = texture(atlas[inTexIdx], texCoordFront).rgb;
-    vec3 backColor = texture(atlas[inTexIdx+1], texCoordBack).rgb;
+    float halfTexel = 1.f / textureSize(skies[inTexIdx], 0).x;
+    texCoordFront = skyLayerCoord(texCoordFront, 0.f, halfTexel);
+    texCoordBack = skyLayerCoord(texCoordBack, 1.f, halfTexel);
+
+    vec3 frontColor = texture(skies[inTexIdx], vec3(texCoordFront, 0)).rgb;
+    vec3 backColor = texture(skies[inTexIdx], vec3(texCoordBack, 0)).rgb;
     vec3 color = frontColor;
     if (frontColor.x + frontColor.y + frontColor.z < .01f) {
         color = backColor;
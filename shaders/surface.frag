@@ -0,0 +1,15 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// NOTE(jan): Lit surfaces of each face in one array, see SurfaceCache.h.
+layout(binding=1) uniform sampler2DArray surfaces;
+
+layout(location=0) in vec2 inTexCoord;
+layout(location=1) in flat uint inLayer;
+
+layout(location=0) out vec4 outColor;
+
+void main() {
+    vec3 coord = vec3(inTexCoord, float(inLayer));
+    outColor = vec4(texture(surfaces, coord).rgb, 1);
+}
@@ -0,0 +1,30 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+#include "uniforms.glsl"
+#include "faces.glsl"
+
+// NOTE(jan): See SurfacePlacement in SurfaceCache.h.
+struct SurfacePlacement {
+    vec4 transform;
+    uint layer;
+};
+
+layout(binding=8) readonly buffer SurfacePlacements {
+    SurfacePlacement placements[];
+} surfacePlacements;
+
+layout(location=0) in vec3 inPosition;
+layout(location=1) in uint inFaceIdx;
+
+layout(location=0) out vec2 outTexCoord;
+layout(location=1) out flat uint outLayer;
+
+void main() {
+    FaceRecord face = faceRecords.faces[inFaceIdx];
+    gl_Position = uniforms.mvp * faceWorldPosition(face, inPosition);
+    SurfacePlacement placement = surfacePlacements.placements[inFaceIdx];
+    outTexCoord = faceTexCoord(face, inPosition) * placement.transform.xy +
+        placement.transform.zw;
+    outLayer = placement.layer;
+}
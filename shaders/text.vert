@@ -1,14 +1,28 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout (location=0) in vec3 position;
-layout (location=1) in vec4 inColor;
+// NOTE(jan): See TextGlyph in RenderText.cpp.
+struct Glyph {
+    vec4 rect;
+    vec4 colour;
+};
+
+// NOTE(jan): The indirect draw takes up the first 32 bytes, see TextBlock in
+// RenderText.cpp.
+layout(binding=0) readonly buffer Text {
+    uint draw[8];
+    Glyph glyphs[];
+} text;
+
+layout (location=0) in vec2 inCorner;
 
 layout (location=0) out vec4 outColor;
 
 const float fontSize = 4.f;
 
 void main() {
+    Glyph glyph = text.glyphs[gl_InstanceIndex];
+    vec2 position = mix(glyph.rect.xy, glyph.rect.zw, inCorner);
     gl_Position = vec4(-1 + position.x / (1920.f / fontSize), -1 + position.y / (1080.f / fontSize), 0.000001, 1);
-    outColor = inColor;
+    outColor = glyph.colour;
 }
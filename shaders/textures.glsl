@@ -0,0 +1,28 @@
+// NOTE(jan): See TextureTable in BSPTextureParser.h.
+struct TextureAnimation {
+    uint frameCount;
+    uint firstFrame;
+};
+
+layout(binding=3) readonly buffer TextureAnimations {
+    TextureAnimation animations[];
+} textureAnimations;
+
+layout(binding=4) readonly buffer TextureFrames {
+    uint frames[];
+} textureFrames;
+
+// NOTE(jan): Packed texture array location of each texture slot. Rewritten
+// by the CPU as textures are streamed in and out, see TextureStreamer.h.
+layout(binding=5) readonly buffer TextureLocations {
+    uint locations[];
+} textureLocations;
+
+// NOTE(jan): Maps a texture slot to the packed texture array location of its
+// current animation frame, see resolveTextureFrame in BSPTextureParser.h.
+uint resolveTexture(uint slot) {
+    TextureAnimation animation = textureAnimations.animations[slot];
+    uint frame = uniforms.textureFrame % animation.frameCount;
+    uint frameSlot = textureFrames.frames[animation.firstFrame + frame];
+    return textureLocations.locations[frameSlot];
+}
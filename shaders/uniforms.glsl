@@ -3,4 +3,6 @@ layout(binding=0) uniform Uniform {
     vec3 origin;
     float elapsedS;
     float light[12];
+    // NOTE(jan): See textureAnimationFrame in BSPTextureParser.h.
+    uint textureFrame;
 } uniforms;
@@ -0,0 +1,16 @@
+#include "Arena.h"
+
+Arena::Arena(size_t capacity):
+    base(new uint8_t[capacity]),
+    capacity(capacity),
+    used(0)
+{
+}
+
+Arena::~Arena() {
+    delete[] base;
+}
+
+void Arena::reset() {
+    used = 0;
+}
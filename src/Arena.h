@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+using std::runtime_error;
+
+/* NOTE(jan): Bump allocator for scratch memory that dies all at once. Memory
+   is handed out in order and only reclaimed by reset, and nothing allocated
+   from it is ever destructed, so it only holds plain data. */
+struct Arena {
+    Arena(size_t capacity);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    template<typename T>
+    T* alloc(size_t count) {
+        size_t aligned = (used + alignof(T) - 1) & ~(alignof(T) - 1);
+        size_t size = count * sizeof(T);
+        if (aligned + size > capacity) {
+            throw runtime_error("arena is full");
+        }
+        used = aligned + size;
+        return (T*)(base + aligned);
+    }
+
+    void reset();
+
+private:
+    uint8_t* base;
+    size_t capacity;
+    size_t used;
+};
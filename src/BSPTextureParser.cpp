@@ -1,13 +1,41 @@
+#include <chrono>
+#include <mutex>
+
 #include "BSPTextureParser.h"
+#include "CookedCache.h"
+#include "Logging.h"
+#include "SurfaceCache.h"
+#include "TexturePacker.h"
+#include "TextureRegistry.h"
 
 BSPTextureParser::BSPTextureParser(FILE* file, int32_t offset, Palette& palette):
+    defaultPacker(nullptr),
+    fluidPacker(nullptr),
+    palette(palette),
     baseOffset(offset),
-    file(file),
-    palette(palette)
+    file(file)
 {
     parseHeader();
     parseTextureHeaders();
     parseTextures();
+    packTextures();
+    decodeTextures(textures, *defaultPacker, defaultDecodes);
+    decodeTextures(fluidTextures, *fluidPacker, fluidDecodes);
+    for (auto& texture: skyTextures) {
+        getJobSystem().submit(skyDecodes, [this, &texture]() {
+            decodeTexture(palette, texture);
+        });
+    }
+}
+
+BSPTextureParser::~BSPTextureParser() {
+    auto& jobs = getJobSystem();
+    for (auto& decodes: defaultDecodes) jobs.wait(decodes);
+    for (auto& decodes: fluidDecodes) jobs.wait(decodes);
+    jobs.wait(skyDecodes);
+
+    delete defaultPacker;
+    delete fluidPacker;
 }
 
 void BSPTextureParser::parseHeader() {
@@ -34,7 +62,11 @@ void BSPTextureParser::parseTextureHeaders() {
     auto count = header.numtex;
     auto elementSize = sizeof(TextureHeader);
 
-    texTypes.resize(count);
+    records.resize(count);
+    for (auto& record: records) {
+        record.type = TEXTYPE::DEBUG;
+        record.slot = TEXTURE_SLOT_INVALID;
+    }
 
     textureHeaders.resize(count);
 
@@ -55,93 +87,282 @@ void BSPTextureParser::parseTextureHeaders() {
 void BSPTextureParser::parseTexture(int idx, Texture& texture) {
     auto headerOffset = header.offset[idx];
     auto& header = textureHeaders[idx];
+    memcpy(texture.name, header.name, sizeof(texture.name));
     texture.width = header.width;
     texture.height = header.height;
     auto size = header.width * header.height;
 
+    auto& record = records[idx];
     if ((strncmp(header.name, "clip", 4) == 0) ||
             (strncmp(header.name, "trigger", 7) == 0) ||
             (size == 0)) {
-        texTypes[idx] = TEXTYPE::DEBUG;
+        record.type = TEXTYPE::DEBUG;
     } else if (strncmp(header.name, "sky", 3) == 0) {
-        texTypes[idx] = TEXTYPE::SKY;
+        record.type = TEXTYPE::SKY;
     } else if (strncmp(header.name, "*", 1) == 0) {
-        texTypes[idx] = TEXTYPE::FLUID;
+        record.type = TEXTYPE::FLUID;
     } else {
-        texTypes[idx] = TEXTYPE::DEFAULT;
+        record.type = TEXTYPE::DEFAULT;
+    }
+
+    // NOTE(jan): The sky is split into layers in sky.frag, and mip levels
+    // would bleed the layers into each other.
+    texture.mipLevels = record.type == TEXTYPE::SKY ? 1 : MIP_LEVELS;
+    if (record.type == TEXTYPE::DEBUG) {
+        texture.mipLevels = 0;
     }
 
-    vector<uint8_t> textureColorIndices(size);
+    uint32_t mipOffsets[MIP_LEVELS] = {
+        header.offset1,
+        header.offset2,
+        header.offset4,
+        header.offset8
+    };
+    texture.colorIndices.resize(textureTexelCount(texture));
+    auto dst = texture.colorIndices.data();
+    for (uint32_t level = 0; level < texture.mipLevels; level++) {
+        auto count = mipTexelCount(texture.width, texture.height, level);
+        seek(file, baseOffset + headerOffset + mipOffsets[level]);
+        fread_s(dst, count, count, 1, file);
+        dst += count;
+    }
+
+    // NOTE(jan): Sky textures are uploaded uncompressed, see sky.frag.
+    if (record.type == TEXTYPE::SKY) {
+        texture.format = TEXFORMAT::RGBA8;
+    } else {
+        texture.format = chooseTextureFormat(texture);
+    }
 
-    seek(file, baseOffset + headerOffset + header.offset1);
-    fread_s(textureColorIndices.data(), size, size, 1, file);
+    uint32_t description[] = {
+        (uint32_t)record.type,
+        (uint32_t)texture.format,
+        texture.width,
+        texture.height,
+        texture.mipLevels
+    };
+    texture.hash = hashBytes(description, sizeof(description));
+    texture.hash = hashBytes(
+        texture.colorIndices.data(),
+        texture.colorIndices.size(),
+        texture.hash
+    );
+}
 
-    texture.texels.resize(size * 4);
+static std::mutex compressionStatsLock;
+static uint32_t compressionStatsTextures = 0;
+static uint64_t compressionStatsMicroseconds = 0;
 
-    for (uint32_t i = 0; i < size; i++) {
-        auto colorIdx = textureColorIndices[i];
-        auto paletteColor = palette.colors[colorIdx];
-        texture.texels[i*4] = paletteColor.r;
-        texture.texels[i*4+1] = paletteColor.g;
-        texture.texels[i*4+2] = paletteColor.b;
-        texture.texels[i*4+3] = 255;
+void logCompressionStats() {
+    std::lock_guard<std::mutex> guard(compressionStatsLock);
+    if (compressionStatsTextures == 0) {
+        return;
     }
+    INFO(
+        "compressed %d textures in %.2fms",
+        compressionStatsTextures,
+        compressionStatsMicroseconds / 1000.0
+    );
 }
 
-void BSPTextureParser::splitSkyTexture(
-    int idx,
-    Texture& texture,
-    Texture& front,
-    Texture& back
-) {
-    auto& header = textureHeaders[idx];
-    auto halfSize = header.width * header.height * 4 / 2;
-    front.width = back.width = header.width / 2;
-    front.height = back.height = header.height;
-    front.texels.resize(halfSize);
-    back.texels.resize(halfSize);
-    auto src = texture.texels.data();
-    auto f = front.texels.data();
-    auto b = back.texels.data();
-    for (uint32_t y = 0; y < header.height; y++) {
-        for (uint32_t x = 0; x < header.width / 2; x++) {
-            for (uint32_t c = 0; c < 4; c++) {
-                *f++ = *src++;
-            }
-        }
-        for (uint32_t x = header.width / 2; x < header.width; x++) {
-            for (uint32_t c = 0; c < 4; c++) {
-                *b++ = *src++;
-            }
+TEXFORMAT chooseTextureFormat(Texture& texture) {
+    if (!compressTextures) {
+        return TEXFORMAT::RGBA8;
+    }
+    for (auto colorIdx: texture.colorIndices) {
+        if (colorIdx >= FULLBRIGHT_START) {
+            return TEXFORMAT::BC3;
         }
     }
+    return TEXFORMAT::BC1;
+}
+
+void compressTexture(Texture& texture, vector<uint8_t>& rgba) {
+    uint32_t byteSize = 0;
+    for (uint32_t level = 0; level < texture.mipLevels; level++) {
+        byteSize += mipByteSize(
+            texture.format,
+            texture.width,
+            texture.height,
+            level
+        );
+    }
 
+    uint32_t description[] = {
+        (uint32_t)texture.format,
+        texture.width,
+        texture.height,
+        texture.mipLevels
+    };
+    auto key = hashBytes(&COOKED_VERSION, sizeof(COOKED_VERSION));
+    key = hashBytes(description, sizeof(description), key);
+    key = hashBytes(rgba.data(), rgba.size(), key);
+    if (loadCooked(key, texture.texels) && (texture.texels.size() == byteSize)) {
+        return;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    texture.texels.resize(byteSize);
+    auto src = rgba.data();
+    auto dst = texture.texels.data();
+    for (uint32_t level = 0; level < texture.mipLevels; level++) {
+        auto width = texture.width >> level;
+        auto height = texture.height >> level;
+        compressImage(texture.format, src, width, height, dst);
+        src += width * height * 4;
+        dst += mipByteSize(texture.format, texture.width, texture.height, level);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(
+        end - start
+    ).count();
+    {
+        std::lock_guard<std::mutex> guard(compressionStatsLock);
+        compressionStatsTextures++;
+        compressionStatsMicroseconds += microseconds;
+    }
+
+    storeCooked(key, texture.texels);
+}
+
+void decodeTexture(Palette& palette, Texture& texture) {
+    auto count = (uint32_t)texture.colorIndices.size();
+    vector<uint8_t> rgba(count * 4);
+    palette.expand(texture.colorIndices.data(), count, rgba.data());
+    if (!surfaceCacheEnabled) {
+        texture.colorIndices.clear();
+        texture.colorIndices.shrink_to_fit();
+    }
+
+    if (texture.format == TEXFORMAT::RGBA8) {
+        texture.texels = std::move(rgba);
+    } else {
+        compressTexture(texture, rgba);
+    }
 }
 
 void BSPTextureParser::parseTextures() {
     // NOTE(jan): for some reason, textures can sometimes have a zero area.
-    // To prevent this causing problems we skip such textures and map
-    // their indices to a large texture index so the error is obvious.
+    // To prevent this causing problems we skip such textures and leave
+    // their slot invalid so the error is obvious.
     for (int idx = 0; idx < header.numtex; idx++) {
-        auto& textureHeader = textureHeaders[idx];
         Texture texture = {};
         parseTexture(idx, texture);
-        auto texType = texTypes[idx];
-        if (texType == TEXTYPE::DEBUG) {
-            texNums[idx] = -1;
-        } else if (texType == TEXTYPE::SKY) {
-            Texture front = {};
-            Texture back = {};
-            splitSkyTexture(idx, texture, front, back);
-            texNums[idx] = (uint32_t)skyTextures.size();
-            skyTextures.push_back(front);
-            skyTextures.push_back(back);
-        } else if (texType == TEXTYPE::FLUID) {
-            texNums[idx] = (uint32_t)fluidTextures.size();
-            fluidTextures.push_back(texture);
+        auto& record = records[idx];
+        if (record.type == TEXTYPE::DEBUG) {
+            record.slot = TEXTURE_SLOT_INVALID;
+        } else if (record.type == TEXTYPE::SKY) {
+            // NOTE(jan): The front and back layers are the left and right
+            // halves of the texture, sky.frag samples them in place.
+            record.slot = (uint32_t)skyTextures.size();
+            skyTextures.push_back(std::move(texture));
+        } else if (record.type == TEXTYPE::FLUID) {
+            record.slot = (uint32_t)fluidTextures.size();
+            fluidTextures.push_back(std::move(texture));
         } else {
-            texNums[idx] = (uint32_t)textures.size();
-            textures.push_back(texture);
+            record.slot = (uint32_t)textures.size();
+            textures.push_back(std::move(texture));
+        }
+    }
+}
+
+void BSPTextureParser::packTextures() {
+    defaultPacker = new TexturePacker(textures);
+    fluidPacker = new TexturePacker(fluidTextures);
+
+    animateTextures(textures, defaultTable);
+    animateTextures(fluidTextures, fluidTable);
+}
+
+void BSPTextureParser::decodeTextures(
+    vector<Texture>& textures,
+    TexturePacker& packer,
+    vector<JobCounter>& decodes
+) {
+    auto& jobs = getJobSystem();
+    auto& registry = getTextureRegistry();
+    decodes = vector<JobCounter>(packer.arrays.size());
+    for (size_t arrayIdx = 0; arrayIdx < packer.arrays.size(); arrayIdx++) {
+        for (auto texIdx: packer.arrays[arrayIdx].members) {
+            auto& texture = textures[texIdx];
+            // NOTE(jan): Textures shared with a map that is still loaded are
+            // already on the GPU.
+            if (registry.contains(texture.hash)) {
+                if (!surfaceCacheEnabled) {
+                    texture.colorIndices.clear();
+                    texture.colorIndices.shrink_to_fit();
+                }
+                continue;
+            }
+            jobs.submit(decodes[arrayIdx], [this, &texture]() {
+                decodeTexture(palette, texture);
+            });
+        }
+    }
+}
+
+void BSPTextureParser::animateTextures(
+    vector<Texture>& textures,
+    TextureTable& table
+) {
+    const int MAX_ANIMATION_FRAMES = 10;
+
+    auto count = (uint32_t)textures.size();
+    table.animations.resize(count);
+
+    for (uint32_t texIdx = 0; texIdx < count; texIdx++) {
+        auto& texture = textures[texIdx];
+        auto& animation = table.animations[texIdx];
+
+        // NOTE(jan): Textures named "+0name" to "+9name" form a chain, with
+        // "+aname" to "+jname" forming the alternate chain.
+        if (texture.name[0] != '+') {
+            animation.frameCount = 1;
+            animation.firstFrame = (uint32_t)table.frames.size();
+            table.frames.push_back(texIdx);
+            continue;
+        }
+
+        uint32_t primary[MAX_ANIMATION_FRAMES];
+        uint32_t alternate[MAX_ANIMATION_FRAMES];
+        for (int i = 0; i < MAX_ANIMATION_FRAMES; i++) {
+            primary[i] = TEXTURE_SLOT_INVALID;
+            alternate[i] = TEXTURE_SLOT_INVALID;
+        }
+
+        for (uint32_t otherIdx = 0; otherIdx < count; otherIdx++) {
+            auto& other = textures[otherIdx];
+            if ((other.name[0] != '+') ||
+                    (strncmp(other.name + 2, texture.name + 2, 14) != 0)) {
+                continue;
+            }
+            char frame = (char)tolower(other.name[1]);
+            if ((frame >= '0') && (frame <= '9')) {
+                primary[frame - '0'] = otherIdx;
+            } else if ((frame >= 'a') && (frame <= 'j')) {
+                alternate[frame - 'a'] = otherIdx;
+            }
+        }
+
+        // NOTE(jan): A face animates through the chain it references.
+        // Brush entities are never triggered, so the other chain is not
+        // needed.
+        bool isAlternate = !isdigit(texture.name[1]);
+        auto chain = isAlternate ? alternate : primary;
+
+        animation.firstFrame = (uint32_t)table.frames.size();
+        animation.frameCount = 0;
+        for (int i = 0; i < MAX_ANIMATION_FRAMES; i++) {
+            if (chain[i] != TEXTURE_SLOT_INVALID) {
+                table.frames.push_back(chain[i]);
+                animation.frameCount++;
+            }
+        }
+        // NOTE(jan): Names past "+9" and "+j", like "+kname", are in neither
+        // chain.
+        if (animation.frameCount == 0) {
+            table.frames.push_back(texIdx);
+            animation.frameCount = 1;
         }
     }
 }
@@ -1,17 +1,18 @@
 #pragma once
 
+#include <cctype>
 #include <exception>
-#include <map>
 #include <vector>
 
 #include <glm/vec3.hpp>
 
+#include "BlockCompression.h"
 #include "FileSystem.h"
+#include "JobSystem.h"
 #include "Palette.h"
 
 using glm::vec3;
 
-using std::map;
 using std::runtime_error;
 using std::vector;
 
@@ -22,6 +23,52 @@ enum TEXTYPE {
     DEBUG
 };
 
+// NOTE(jan): Slot of textures that are not uploaded, like debug brushes.
+const uint32_t TEXTURE_SLOT_INVALID = 0xFFFFFF;
+
+struct TextureRecord {
+    TEXTYPE type: 8;
+    // NOTE(jan): Index into textures, fluidTextures or skyTextures.
+    uint32_t slot: 24;
+};
+
+// NOTE(jan): Quake animates textures at 5 frames per second.
+const float TEXTURE_ANIMATION_FPS = 5.f;
+
+// NOTE(jan): Never empty, a texture outside any chain animates to itself.
+struct TextureAnimation {
+    uint32_t frameCount;
+    uint32_t firstFrame;
+};
+
+// NOTE(jan): Animation frame at the current time, before wrapping to the length
+// of a chain. Passed to the shaders in the uniforms, so they share the rate.
+inline uint32_t textureAnimationFrame(float elapsedS) {
+    return (uint32_t)(elapsedS * TEXTURE_ANIMATION_FPS);
+}
+
+// NOTE(jan): Resolves a texture slot to the slot of its animation frame at
+// the current time. Uploaded as storage buffers, see textures.glsl.
+struct TextureTable {
+    // NOTE(jan): One per texture slot.
+    vector<TextureAnimation> animations;
+    // NOTE(jan): Texture slots. The renderer maps these to texture array
+    // locations, which change as textures are streamed in and out.
+    vector<uint32_t> frames;
+};
+
+// NOTE(jan): CPU side of resolveTexture in textures.glsl. Returns the slot of
+// the current animation frame.
+inline uint32_t resolveTextureFrame(
+    TextureTable& table,
+    uint32_t slot,
+    float elapsedS
+) {
+    auto& animation = table.animations[slot];
+    auto frame = textureAnimationFrame(elapsedS) % animation.frameCount;
+    return table.frames[animation.firstFrame + frame];
+}
+
 struct TextureIndex {
     int32_t numtex;
     vector<int32_t> offset;
@@ -37,27 +84,75 @@ struct TextureHeader {
     uint32_t offset8;
 };
 
+// NOTE(jan): Quake stores four mip levels for each world texture.
+const uint32_t MIP_LEVELS = 4;
+
 struct Texture {
+    char name[16];
     uint32_t width;
     uint32_t height;
+    uint32_t mipLevels;
+    TEXFORMAT format;
+    // NOTE(jan): Content hash of the type, format, size and palette indices.
+    // Identifies the texture across maps, see TextureRegistry.h.
+    uint64_t hash;
+    // NOTE(jan): Palette indices of every mip level, largest first. Released
+    // once the texture has been decoded, unless the surface cache needs them.
+    vector<uint8_t> colorIndices;
+    // NOTE(jan): Texels or blocks of every mip level, largest first.
     vector<uint8_t> texels;
 };
 
+inline uint32_t mipTexelCount(uint32_t width, uint32_t height, uint32_t level) {
+    return (width >> level) * (height >> level);
+}
+
+inline uint32_t textureTexelCount(Texture& texture) {
+    uint32_t count = 0;
+    for (uint32_t level = 0; level < texture.mipLevels; level++) {
+        count += mipTexelCount(texture.width, texture.height, level);
+    }
+    return count;
+}
+
+// NOTE(jan): Picks a block compressed format when compression is enabled.
+TEXFORMAT chooseTextureFormat(Texture&);
+
+// NOTE(jan): Expands palette indices and compresses the result if the texture
+// has a compressed format. Safe to run on the job system.
+void decodeTexture(Palette&, Texture&);
+
+// NOTE(jan): Logs how many textures were compressed and how long it took,
+// summed over the job system's threads. Quality is checked by
+// tests/BlockCompressionTest.cpp instead of at load time.
+void logCompressionStats();
+
+struct TexturePacker;
+
 struct BSPTextureParser {
     vector<Texture> textures;
     vector<Texture> skyTextures;
     vector<Texture> fluidTextures;
-    // NOTE(jan): Maps Quake texId to the Vulkan texture array
-    map<uint32_t, uint32_t> texNums;
-    vector<TEXTYPE> texTypes;
+    // NOTE(jan): Indexed by Quake texId.
+    vector<TextureRecord> records;
     vector<TextureHeader> textureHeaders;
+    TexturePacker* defaultPacker;
+    TexturePacker* fluidPacker;
+    TextureTable defaultTable;
+    TextureTable fluidTable;
+    // NOTE(jan): Decoding happens on the job system, with one batch per
+    // texture array so each array can be uploaded as soon as it is ready.
+    vector<JobCounter> defaultDecodes;
+    vector<JobCounter> fluidDecodes;
+    JobCounter skyDecodes;
+    Palette& palette;
 
     BSPTextureParser(FILE*, int32_t, Palette&);
+    ~BSPTextureParser();
 
 private:
     int32_t baseOffset;
     FILE* file;
-    Palette& palette;
 
     TextureIndex header;
 
@@ -65,10 +160,14 @@ private:
     void parseTextureHeaders();
     void parseTexture(int, Texture&);
     void parseTextures();
-    void splitSkyTexture(
-        int idx,
-        Texture& texture,
-        Texture& front,
-        Texture& back
+    void packTextures();
+    void decodeTextures(
+        vector<Texture>& textures,
+        TexturePacker& packer,
+        vector<JobCounter>& decodes
+    );
+    void animateTextures(
+        vector<Texture>& textures,
+        TextureTable& table
     );
 };
@@ -0,0 +1,367 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <emmintrin.h>
+
+#include "BlockCompression.h"
+
+bool compressTextures = false;
+
+struct Color565 {
+    uint16_t packed;
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+};
+
+Color565 quantize565(float r, float g, float b) {
+    auto clamp8 = [](float v) {
+        return v < 0 ? 0 : v > 255 ? 255 : (int)(v + .5f);
+    };
+    int r5 = (clamp8(r) * 31 + 127) / 255;
+    int g6 = (clamp8(g) * 63 + 127) / 255;
+    int b5 = (clamp8(b) * 31 + 127) / 255;
+
+    Color565 result;
+    result.packed = (uint16_t)((r5 << 11) | (g6 << 5) | b5);
+    result.r = (uint8_t)((r5 << 3) | (r5 >> 2));
+    result.g = (uint8_t)((g6 << 2) | (g6 >> 4));
+    result.b = (uint8_t)((b5 << 3) | (b5 >> 2));
+    return result;
+}
+
+Color565 unpack565(uint16_t packed) {
+    int r5 = (packed >> 11) & 31;
+    int g6 = (packed >> 5) & 63;
+    int b5 = packed & 31;
+
+    Color565 result;
+    result.packed = packed;
+    result.r = (uint8_t)((r5 << 3) | (r5 >> 2));
+    result.g = (uint8_t)((g6 << 2) | (g6 >> 4));
+    result.b = (uint8_t)((b5 << 3) | (b5 >> 2));
+    return result;
+}
+
+void loadBlock(
+    const uint8_t* rgba,
+    uint32_t width,
+    uint32_t height,
+    uint32_t blockX,
+    uint32_t blockY,
+    uint8_t* block
+) {
+    for (uint32_t y = 0; y < 4; y++) {
+        auto srcY = blockY * 4 + y;
+        if (srcY >= height) srcY = height - 1;
+        for (uint32_t x = 0; x < 4; x++) {
+            auto srcX = blockX * 4 + x;
+            if (srcX >= width) srcX = width - 1;
+            memcpy(block + (y * 4 + x) * 4, rgba + (srcY * width + srcX) * 4, 4);
+        }
+    }
+}
+
+// NOTE(jan): Picks the nearest of the four palette colours for each of the
+// sixteen texels, four texels at a time.
+uint32_t selectColorIndices(const uint8_t* block, Color565* palette) {
+    __m128 paletteR[4];
+    __m128 paletteG[4];
+    __m128 paletteB[4];
+    for (int i = 0; i < 4; i++) {
+        paletteR[i] = _mm_set1_ps(palette[i].r);
+        paletteG[i] = _mm_set1_ps(palette[i].g);
+        paletteB[i] = _mm_set1_ps(palette[i].b);
+    }
+
+    uint32_t indices = 0;
+    for (int group = 0; group < 4; group++) {
+        auto texels = block + group * 16;
+        __m128 r = _mm_set_ps(texels[12], texels[8], texels[4], texels[0]);
+        __m128 g = _mm_set_ps(texels[13], texels[9], texels[5], texels[1]);
+        __m128 b = _mm_set_ps(texels[14], texels[10], texels[6], texels[2]);
+
+        __m128 bestDistance = _mm_set1_ps(1e30f);
+        __m128i bestIndex = _mm_setzero_si128();
+        for (int i = 0; i < 4; i++) {
+            __m128 dr = _mm_sub_ps(r, paletteR[i]);
+            __m128 dg = _mm_sub_ps(g, paletteG[i]);
+            __m128 db = _mm_sub_ps(b, paletteB[i]);
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)),
+                _mm_mul_ps(db, db)
+            );
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, bestDistance));
+            bestDistance = _mm_min_ps(distance, bestDistance);
+            bestIndex = _mm_or_si128(
+                _mm_and_si128(closer, _mm_set1_epi32(i)),
+                _mm_andnot_si128(closer, bestIndex)
+            );
+        }
+
+        alignas(16) uint32_t groupIndices[4];
+        _mm_store_si128((__m128i*)groupIndices, bestIndex);
+        for (int i = 0; i < 4; i++) {
+            indices |= groupIndices[i] << ((group * 4 + i) * 2);
+        }
+    }
+    return indices;
+}
+
+void encodeBC1Block(const uint8_t* block, uint8_t* out) {
+    float mean[3] = {};
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) {
+            mean[c] += block[i*4+c];
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        mean[c] /= 16.f;
+    }
+
+    float covariance[6] = {};
+    for (int i = 0; i < 16; i++) {
+        float r = block[i*4] - mean[0];
+        float g = block[i*4+1] - mean[1];
+        float b = block[i*4+2] - mean[2];
+        covariance[0] += r * r;
+        covariance[1] += r * g;
+        covariance[2] += r * b;
+        covariance[3] += g * g;
+        covariance[4] += g * b;
+        covariance[5] += b * b;
+    }
+
+    // NOTE(jan): Power iteration for the principal axis of the block.
+    float axis[3] = { 1.f, 1.f, 1.f };
+    for (int iteration = 0; iteration < 4; iteration++) {
+        float x = covariance[0]*axis[0] + covariance[1]*axis[1] + covariance[2]*axis[2];
+        float y = covariance[1]*axis[0] + covariance[3]*axis[1] + covariance[4]*axis[2];
+        float z = covariance[2]*axis[0] + covariance[4]*axis[1] + covariance[5]*axis[2];
+        float length = std::max(std::max(fabsf(x), fabsf(y)), fabsf(z));
+        if (length < 1e-6f) break;
+        axis[0] = x / length;
+        axis[1] = y / length;
+        axis[2] = z / length;
+    }
+
+    float minProjection = 1e30f;
+    float maxProjection = -1e30f;
+    for (int i = 0; i < 16; i++) {
+        float projection =
+            (block[i*4] - mean[0]) * axis[0] +
+            (block[i*4+1] - mean[1]) * axis[1] +
+            (block[i*4+2] - mean[2]) * axis[2];
+        minProjection = std::min(minProjection, projection);
+        maxProjection = std::max(maxProjection, projection);
+    }
+
+    float lengthSquared = axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2];
+    float minScale = lengthSquared > 0 ? minProjection / lengthSquared : 0;
+    float maxScale = lengthSquared > 0 ? maxProjection / lengthSquared : 0;
+    auto c0 = quantize565(
+        mean[0] + axis[0] * maxScale,
+        mean[1] + axis[1] * maxScale,
+        mean[2] + axis[2] * maxScale
+    );
+    auto c1 = quantize565(
+        mean[0] + axis[0] * minScale,
+        mean[1] + axis[1] * minScale,
+        mean[2] + axis[2] * minScale
+    );
+
+    // NOTE(jan): c0 > c1 selects the four colour mode.
+    if (c0.packed < c1.packed) {
+        std::swap(c0, c1);
+    }
+
+    uint32_t indices = 0;
+    if (c0.packed != c1.packed) {
+        Color565 palette[4];
+        palette[0] = c0;
+        palette[1] = c1;
+        palette[2].r = (uint8_t)((2 * c0.r + c1.r) / 3);
+        palette[2].g = (uint8_t)((2 * c0.g + c1.g) / 3);
+        palette[2].b = (uint8_t)((2 * c0.b + c1.b) / 3);
+        palette[3].r = (uint8_t)((c0.r + 2 * c1.r) / 3);
+        palette[3].g = (uint8_t)((c0.g + 2 * c1.g) / 3);
+        palette[3].b = (uint8_t)((c0.b + 2 * c1.b) / 3);
+        indices = selectColorIndices(block, palette);
+    }
+
+    memcpy(out, &c0.packed, 2);
+    memcpy(out + 2, &c1.packed, 2);
+    memcpy(out + 4, &indices, 4);
+}
+
+void decodeBC1Block(const uint8_t* in, uint8_t* block) {
+    uint16_t packed0, packed1;
+    uint32_t indices;
+    memcpy(&packed0, in, 2);
+    memcpy(&packed1, in + 2, 2);
+    memcpy(&indices, in + 4, 4);
+
+    auto c0 = unpack565(packed0);
+    auto c1 = unpack565(packed1);
+    uint8_t palette[4][4] = {
+        { c0.r, c0.g, c0.b, 255 },
+        { c1.r, c1.g, c1.b, 255 },
+    };
+    if (packed0 > packed1) {
+        palette[2][0] = (uint8_t)((2 * c0.r + c1.r) / 3);
+        palette[2][1] = (uint8_t)((2 * c0.g + c1.g) / 3);
+        palette[2][2] = (uint8_t)((2 * c0.b + c1.b) / 3);
+        palette[3][0] = (uint8_t)((c0.r + 2 * c1.r) / 3);
+        palette[3][1] = (uint8_t)((c0.g + 2 * c1.g) / 3);
+        palette[3][2] = (uint8_t)((c0.b + 2 * c1.b) / 3);
+    } else {
+        palette[2][0] = (uint8_t)((c0.r + c1.r) / 2);
+        palette[2][1] = (uint8_t)((c0.g + c1.g) / 2);
+        palette[2][2] = (uint8_t)((c0.b + c1.b) / 2);
+    }
+    palette[2][3] = 255;
+    palette[3][3] = packed0 > packed1 ? 255 : 0;
+
+    for (int i = 0; i < 16; i++) {
+        memcpy(block + i * 4, palette[(indices >> (i * 2)) & 3], 4);
+    }
+}
+
+void encodeBC3AlphaBlock(const uint8_t* block, uint8_t* out) {
+    uint8_t a0 = 0;
+    uint8_t a1 = 255;
+    for (int i = 0; i < 16; i++) {
+        a0 = std::max(a0, block[i*4+3]);
+        a1 = std::min(a1, block[i*4+3]);
+    }
+
+    uint8_t palette[8] = { a0, a1 };
+    for (int i = 1; i < 7; i++) {
+        palette[i+1] = (uint8_t)(((7 - i) * a0 + i * a1) / 7);
+    }
+
+    uint64_t indices = 0;
+    if (a0 != a1) {
+        for (int i = 0; i < 16; i++) {
+            int alpha = block[i*4+3];
+            int bestIndex = 0;
+            int bestDistance = 256;
+            for (int j = 0; j < 8; j++) {
+                int distance = abs(alpha - palette[j]);
+                if (distance < bestDistance) {
+                    bestDistance = distance;
+                    bestIndex = j;
+                }
+            }
+            indices |= (uint64_t)bestIndex << (i * 3);
+        }
+    }
+
+    out[0] = a0;
+    out[1] = a1;
+    for (int i = 0; i < 6; i++) {
+        out[2 + i] = (uint8_t)(indices >> (i * 8));
+    }
+}
+
+void decodeBC3AlphaBlock(const uint8_t* in, uint8_t* block) {
+    uint8_t a0 = in[0];
+    uint8_t a1 = in[1];
+    uint8_t palette[8] = { a0, a1 };
+    if (a0 > a1) {
+        for (int i = 1; i < 7; i++) {
+            palette[i+1] = (uint8_t)(((7 - i) * a0 + i * a1) / 7);
+        }
+    } else {
+        for (int i = 1; i < 5; i++) {
+            palette[i+1] = (uint8_t)(((5 - i) * a0 + i * a1) / 5);
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; i++) {
+        indices |= (uint64_t)in[2 + i] << (i * 8);
+    }
+    for (int i = 0; i < 16; i++) {
+        block[i*4+3] = palette[(indices >> (i * 3)) & 7];
+    }
+}
+
+void compressImage(
+    TEXFORMAT format,
+    const uint8_t* rgba,
+    uint32_t width,
+    uint32_t height,
+    uint8_t* blocks
+) {
+    uint32_t blocksX = (width + 3) / 4;
+    uint32_t blocksY = (height + 3) / 4;
+    uint8_t block[64];
+    for (uint32_t blockY = 0; blockY < blocksY; blockY++) {
+        for (uint32_t blockX = 0; blockX < blocksX; blockX++) {
+            loadBlock(rgba, width, height, blockX, blockY, block);
+            if (format == TEXFORMAT::BC3) {
+                encodeBC3AlphaBlock(block, blocks);
+                blocks += 8;
+            }
+            encodeBC1Block(block, blocks);
+            blocks += 8;
+        }
+    }
+}
+
+void decompressImage(
+    TEXFORMAT format,
+    const uint8_t* blocks,
+    uint32_t width,
+    uint32_t height,
+    uint8_t* rgba
+) {
+    uint32_t blocksX = (width + 3) / 4;
+    uint32_t blocksY = (height + 3) / 4;
+    uint8_t block[64];
+    for (uint32_t blockY = 0; blockY < blocksY; blockY++) {
+        for (uint32_t blockX = 0; blockX < blocksX; blockX++) {
+            auto alpha = blocks;
+            if (format == TEXFORMAT::BC3) {
+                blocks += 8;
+            }
+            decodeBC1Block(blocks, block);
+            blocks += 8;
+            if (format == TEXFORMAT::BC3) {
+                decodeBC3AlphaBlock(alpha, block);
+            }
+
+            for (uint32_t y = 0; y < 4; y++) {
+                auto dstY = blockY * 4 + y;
+                if (dstY >= height) break;
+                for (uint32_t x = 0; x < 4; x++) {
+                    auto dstX = blockX * 4 + x;
+                    if (dstX >= width) break;
+                    memcpy(rgba + (dstY * width + dstX) * 4, block + (y * 4 + x) * 4, 4);
+                }
+            }
+        }
+    }
+}
+
+float computePSNR(
+    const uint8_t* expected,
+    const uint8_t* actual,
+    uint32_t texelCount
+) {
+    double squaredError = 0;
+    for (uint32_t i = 0; i < texelCount * 4; i++) {
+        double difference = (double)expected[i] - actual[i];
+        squaredError += difference * difference;
+    }
+    if (squaredError == 0) {
+        return INFINITY;
+    }
+    double meanSquaredError = squaredError / (texelCount * 4);
+    return (float)(10 * log10(255.0 * 255.0 / meanSquaredError));
+}
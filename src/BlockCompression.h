@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+
+enum TEXFORMAT {
+    RGBA8 = 0,
+    // NOTE(jan): Opaque textures.
+    BC1,
+    // NOTE(jan): Textures with fullbrights, which keep their mask in alpha.
+    BC3,
+    // NOTE(jan): Single channel, used for light maps.
+    R8
+};
+
+// NOTE(jan): Set from the command line with -compress, and cleared again when
+// the device cannot sample BC1 and BC3.
+extern bool compressTextures;
+
+inline uint32_t mipByteSize(
+    TEXFORMAT format,
+    uint32_t width,
+    uint32_t height,
+    uint32_t level
+) {
+    width = width >> level;
+    height = height >> level;
+    if (format == TEXFORMAT::RGBA8) {
+        return width * height * 4;
+    }
+    if (format == TEXFORMAT::R8) {
+        return width * height;
+    }
+    uint32_t blocksX = width > 4 ? (width + 3) / 4 : 1;
+    uint32_t blocksY = height > 4 ? (height + 3) / 4 : 1;
+    uint32_t blockSize = format == TEXFORMAT::BC1 ? 8 : 16;
+    return blocksX * blocksY * blockSize;
+}
+
+// NOTE(jan): Compresses an RGBA8 image. Partial blocks at the edges are padded
+// by repeating the last row and column.
+void compressImage(
+    TEXFORMAT format,
+    const uint8_t* rgba,
+    uint32_t width,
+    uint32_t height,
+    uint8_t* blocks
+);
+
+void decompressImage(
+    TEXFORMAT format,
+    const uint8_t* blocks,
+    uint32_t width,
+    uint32_t height,
+    uint8_t* rgba
+);
+
+// NOTE(jan): Peak signal to noise ratio over all four channels, in dB. Used by
+// tests/BlockCompressionTest.cpp to check the encoder's quality.
+float computePSNR(
+    const uint8_t* expected,
+    const uint8_t* actual,
+    uint32_t texelCount
+);
@@ -0,0 +1,50 @@
+#include <filesystem>
+
+#include "CookedCache.h"
+
+const char* COOKED_DIRECTORY = "cooked";
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash) {
+    auto bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+void cookedPath(uint64_t key, char* path, size_t size) {
+    snprintf(path, size, "%s/%016llx.bin", COOKED_DIRECTORY, key);
+}
+
+bool loadCooked(uint64_t key, vector<uint8_t>& data) {
+    char path[MAX_PATH];
+    cookedPath(key, path, sizeof(path));
+
+    FILE* file;
+    if (fopen_s(&file, path, "rb")) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    auto size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data.resize(size);
+    auto readCount = fread(data.data(), 1, size, file);
+    fclose(file);
+    return readCount == size;
+}
+
+void storeCooked(uint64_t key, vector<uint8_t>& data) {
+    std::error_code error;
+    std::filesystem::create_directories(COOKED_DIRECTORY, error);
+
+    char path[MAX_PATH];
+    cookedPath(key, path, sizeof(path));
+
+    FILE* file;
+    if (fopen_s(&file, path, "wb")) {
+        return;
+    }
+    fwrite(data.data(), 1, data.size(), file);
+    fclose(file);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+using std::vector;
+
+// NOTE(jan): Bump this whenever the layout of cooked data changes.
+const uint64_t COOKED_VERSION = 1;
+
+const uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+
+// NOTE(jan): 64-bit FNV-1a.
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = FNV_OFFSET);
+
+// NOTE(jan): Cooked data lives in cooked/ next to the executable, one file per
+// key. Safe to call from worker threads as long as keys differ.
+bool loadCooked(uint64_t key, vector<uint8_t>& data);
+void storeCooked(uint64_t key, vector<uint8_t>& data);
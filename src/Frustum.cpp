@@ -0,0 +1,128 @@
+#include <algorithm>
+
+#include <xmmintrin.h>
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include "Frustum.h"
+
+using glm::clamp;
+using glm::distance;
+using glm::dot;
+using glm::length;
+
+Frustum::Frustum(const mat4& mvp) {
+    // NOTE(jan): glm is column major, so row i is (m[0][i], ..., m[3][i]).
+    vec4 rows[4];
+    for (int i = 0; i < 4; i++) {
+        rows[i] = { mvp[0][i], mvp[1][i], mvp[2][i], mvp[3][i] };
+    }
+
+    planes[0] = rows[3] + rows[0];
+    planes[1] = rows[3] - rows[0];
+    planes[2] = rows[3] + rows[1];
+    planes[3] = rows[3] - rows[1];
+    // NOTE(jan): Uses the -w < z near plane, which is slightly behind the
+    // Vulkan one and so never culls anything visible.
+    planes[4] = rows[3] + rows[2];
+    planes[5] = rows[3] - rows[2];
+
+    for (auto& plane: planes) {
+        plane /= length(vec3(plane));
+    }
+}
+
+bool Frustum::intersects(const vec3& min, const vec3& max) const {
+    for (auto& plane: planes) {
+        // NOTE(jan): Test the corner furthest along the plane normal.
+        vec3 corner = {
+            plane.x > 0 ? max.x : min.x,
+            plane.y > 0 ? max.y : min.y,
+            plane.z > 0 ? max.z : min.z
+        };
+        if (dot(vec3(plane), corner) + plane.w < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Frustum::intersects(const vec4& sphere) const {
+    vec3 centre = sphere;
+    for (auto& plane: planes) {
+        if (dot(vec3(plane), centre) + plane.w < -sphere.w) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool coneFacesAway(const vec4& sphere, const vec4& cone, const vec3& eye) {
+    // NOTE(jan): A face is back facing when the view ray to it is within 90
+    // degrees of its normal. The sine of the cone angle plus the sine of the
+    // angle the sphere covers bounds the sine of their sum.
+    vec3 toCentre = vec3(sphere) - eye;
+    return dot(toCentre, vec3(cone)) >=
+        length(toCentre) * cone.w + sphere.w;
+}
+
+float distanceToBox(const vec3& point, const vec3& min, const vec3& max) {
+    vec3 closest = clamp(point, min, max);
+    return distance(point, closest);
+}
+
+void cullFaces(
+    const FaceTable& faces,
+    uint32_t first,
+    uint32_t count,
+    const Frustum& frustum,
+    const vec3& eye,
+    std::vector<uint32_t>& visible
+) {
+    __m128 zero = _mm_setzero_ps();
+    __m128 eyeX = _mm_set1_ps(eye.x);
+    __m128 eyeY = _mm_set1_ps(eye.y);
+    __m128 eyeZ = _mm_set1_ps(eye.z);
+    for (uint32_t i = 0; i < count; i += 4) {
+        auto face = first + i;
+        __m128 facing = _mm_add_ps(
+            _mm_add_ps(
+                _mm_mul_ps(_mm_loadu_ps(&faces.planeX[face]), eyeX),
+                _mm_mul_ps(_mm_loadu_ps(&faces.planeY[face]), eyeY)
+            ),
+            _mm_add_ps(
+                _mm_mul_ps(_mm_loadu_ps(&faces.planeZ[face]), eyeZ),
+                _mm_loadu_ps(&faces.planeW[face])
+            )
+        );
+        __m128 inside = _mm_cmpgt_ps(facing, zero);
+
+        // NOTE(jan): Same test as Frustum::intersects. The corner to test
+        // only depends on the plane, so it picks whole arrays.
+        for (auto& plane: frustum.planes) {
+            auto x = plane.x > 0 ? &faces.maxX[face] : &faces.minX[face];
+            auto y = plane.y > 0 ? &faces.maxY[face] : &faces.minY[face];
+            auto z = plane.z > 0 ? &faces.maxZ[face] : &faces.minZ[face];
+            __m128 distance = _mm_add_ps(
+                _mm_add_ps(
+                    _mm_mul_ps(_mm_loadu_ps(x), _mm_set1_ps(plane.x)),
+                    _mm_mul_ps(_mm_loadu_ps(y), _mm_set1_ps(plane.y))
+                ),
+                _mm_add_ps(
+                    _mm_mul_ps(_mm_loadu_ps(z), _mm_set1_ps(plane.z)),
+                    _mm_set1_ps(plane.w)
+                )
+            );
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, zero));
+        }
+
+        auto mask = _mm_movemask_ps(inside);
+        auto lanes = std::min(count - i, 4u);
+        for (uint32_t lane = 0; lane < lanes; lane++) {
+            if (mask & (1 << lane)) {
+                visible.push_back(face + lane);
+            }
+        }
+    }
+}
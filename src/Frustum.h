@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include "Mesh.h"
+
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+
+const int FRUSTUM_PLANES = 6;
+
+// NOTE(jan): Clip planes in world space, pointing inwards.
+struct Frustum {
+    vec4 planes[FRUSTUM_PLANES];
+
+    Frustum(const mat4& mvp);
+    bool intersects(const vec3& min, const vec3& max) const;
+    // NOTE(jan): Takes the centre in xyz and the radius in w.
+    bool intersects(const vec4& sphere) const;
+};
+
+// NOTE(jan): Distance from a point to the closest point of a box, zero inside.
+float distanceToBox(const vec3& point, const vec3& min, const vec3& max);
+
+// NOTE(jan): True when every face in the sphere has a normal inside the cone,
+// see Cluster, and so faces away from the eye.
+bool coneFacesAway(const vec4& sphere, const vec4& cone, const vec3& eye);
+
+// NOTE(jan): Appends the faces in [first, first + count) of the table that
+// face the eye and whose bounds touch the frustum, both in the faces' model
+// space.
+void cullFaces(
+    const FaceTable& faces,
+    uint32_t first,
+    uint32_t count,
+    const Frustum& frustum,
+    const vec3& eye,
+    std::vector<uint32_t>& visible
+);
@@ -0,0 +1,77 @@
+#include "JobSystem.h"
+
+JobCounter::JobCounter():
+    pending(0) {}
+
+JobSystem::JobSystem():
+    stopping(false)
+{
+    uint32_t hardwareThreads = thread::hardware_concurrency();
+    uint32_t count = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    for (uint32_t i = 0; i < count; i++) {
+        workers.emplace_back(&JobSystem::work, this);
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::unique_lock<mutex> guard(lock);
+        stopping = true;
+    }
+    jobAvailable.notify_all();
+    for (auto& worker: workers) {
+        worker.join();
+    }
+}
+
+uint32_t JobSystem::threadCount() {
+    return (uint32_t)workers.size() + 1;
+}
+
+void JobSystem::submit(JobCounter& counter, function<void()> work) {
+    counter.pending++;
+    {
+        std::unique_lock<mutex> guard(lock);
+        queue.push_back({ &counter, std::move(work) });
+    }
+    jobAvailable.notify_one();
+}
+
+bool JobSystem::runOne(std::unique_lock<mutex>& guard) {
+    if (queue.empty()) {
+        return false;
+    }
+    Job job = std::move(queue.front());
+    queue.pop_front();
+
+    guard.unlock();
+        job.work();
+        job.counter->pending--;
+    guard.lock();
+
+    jobDone.notify_all();
+    return true;
+}
+
+void JobSystem::wait(JobCounter& counter) {
+    std::unique_lock<mutex> guard(lock);
+    while (counter.pending > 0) {
+        if (!runOne(guard)) {
+            jobDone.wait(guard);
+        }
+    }
+}
+
+void JobSystem::work() {
+    std::unique_lock<mutex> guard(lock);
+    while (!stopping) {
+        if (!runOne(guard)) {
+            jobAvailable.wait(guard);
+        }
+    }
+}
+
+JobSystem& getJobSystem() {
+    static JobSystem jobSystem;
+    return jobSystem;
+}
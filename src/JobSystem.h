@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::atomic;
+using std::condition_variable;
+using std::deque;
+using std::function;
+using std::mutex;
+using std::thread;
+using std::vector;
+
+// NOTE(jan): Counts the unfinished jobs of a batch.
+struct JobCounter {
+    atomic<uint32_t> pending;
+
+    JobCounter();
+};
+
+struct Job {
+    JobCounter* counter;
+    function<void()> work;
+};
+
+struct JobSystem {
+    JobSystem();
+    ~JobSystem();
+
+    uint32_t threadCount();
+    void submit(JobCounter&, function<void()>);
+    // NOTE(jan): Runs queued jobs on the calling thread while waiting.
+    void wait(JobCounter&);
+
+private:
+    bool stopping;
+    mutex lock;
+    condition_variable jobAvailable;
+    condition_variable jobDone;
+    deque<Job> queue;
+    vector<thread> workers;
+
+    bool runOne(std::unique_lock<mutex>&);
+    void work();
+};
+
+JobSystem& getJobSystem();
@@ -0,0 +1,262 @@
+#pragma warning(disable: 4267)
+
+#include <algorithm>
+#include <cstring>
+
+#include <emmintrin.h>
+
+#include "LightCompositor.h"
+
+// NOTE(jan): Copy regions must start on a multiple of 4 bytes.
+static VkDeviceSize alignRegion(VkDeviceSize size) {
+    return (size + 3) & ~(VkDeviceSize)3;
+}
+
+// NOTE(jan): Sums each layer scaled by its style, 8 texels at a time. Scales
+// are 8.8 fixed point, and the sum saturates at full brightness.
+static void blendLightRow(
+    uint8_t* dst,
+    const uint8_t** layers,
+    const uint16_t* scales,
+    uint32_t layerCount,
+    uint32_t offset,
+    uint32_t count
+) {
+    __m128i zero = _mm_setzero_si128();
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i sum = zero;
+        for (uint32_t layer = 0; layer < layerCount; layer++) {
+            __m128i texels = _mm_unpacklo_epi8(
+                _mm_loadl_epi64((const __m128i*)(layers[layer] + offset + i)),
+                zero
+            );
+            __m128i lit = _mm_srli_epi16(
+                _mm_mullo_epi16(texels, _mm_set1_epi16(scales[layer])),
+                8
+            );
+            sum = _mm_adds_epu16(sum, lit);
+        }
+        _mm_storel_epi64((__m128i*)(dst + i), _mm_packus_epi16(sum, zero));
+    }
+    for (; i < count; i++) {
+        uint32_t sum = 0;
+        for (uint32_t layer = 0; layer < layerCount; layer++) {
+            sum += (layers[layer][offset + i] * scales[layer]) >> 8;
+        }
+        dst[i] = (uint8_t)std::min(sum, 255u);
+    }
+}
+
+LightCompositor::LightCompositor(Vulkan& vk, BSPParser& bsp, Mesh& mesh):
+    texels(mesh.lightMap),
+    width(mesh.lightMapWidth),
+    vk(vk),
+    bsp(bsp),
+    faces(mesh.faceLights),
+    uploading(false),
+    cmd(VK_NULL_HANDLE)
+{
+    auto count = (uint32_t)faces.size();
+    faceStyles.resize(count);
+    dirty.resize(count, false);
+    VkDeviceSize stagingSize = 4;
+    for (uint32_t faceIdx = 0; faceIdx < count; faceIdx++) {
+        auto& face = faces[faceIdx];
+        auto styles = mesh.faceRecords[face.record].lightStyles;
+        faceStyles[faceIdx] = styles;
+        for (uint32_t i = 0; i < MAX_LIGHT_STYLES; i++) {
+            auto style = (styles >> (i * 8)) & 0xFF;
+            if (style < LIGHT_STYLE_COUNT) {
+                styleFaces[style].push_back(faceIdx);
+            }
+        }
+        stagingSize += alignRegion(
+            (face.width + 2 * LIGHTMAP_BORDER) *
+            (face.height + 2 * LIGHTMAP_BORDER)
+        );
+        // NOTE(jan): The atlas starts out with the first style at full
+        // brightness, so every face is blended once.
+        markDirty(faceIdx);
+    }
+    // NOTE(jan): No value matches, so the first update sees every style as
+    // changed.
+    for (auto& scale: styleScales) {
+        scale = 0xFFFF;
+    }
+
+    atlas.resize(1);
+    createTextureArray(
+        vk,
+        TEXFORMAT::R8,
+        mesh.lightMapWidth,
+        mesh.lightMapHeight,
+        1,
+        1,
+        atlas[0]
+    );
+    uploadTextureArrayLayers(
+        vk,
+        atlas[0],
+        0,
+        1,
+        texels.data(),
+        texels.size()
+    );
+
+    // NOTE(jan): Sized for every face at once, and stays mapped.
+    createBuffer(
+        vk,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        stagingSize,
+        staging
+    );
+    mappedStaging = (uint8_t*)mapBufferMemory(
+        vk.device,
+        staging.handle,
+        staging.memory
+    );
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VKCHECK(vkCreateFence(vk.device, &fenceInfo, nullptr, &fence));
+}
+
+LightCompositor::~LightCompositor() {
+    if (uploading) {
+        VKCHECK(vkWaitForFences(vk.device, 1, &fence, VK_TRUE, UINT64_MAX));
+        vkFreeCommandBuffers(vk.device, vk.cmdPoolTransient, 1, &cmd);
+    }
+    vkDestroyFence(vk.device, fence, nullptr);
+    unMapMemory(vk.device, staging.memory);
+    destroyBuffer(vk, staging);
+    destroyTextureArray(vk, atlas[0]);
+}
+
+void LightCompositor::markDirty(uint32_t faceIdx) {
+    if (dirty[faceIdx]) {
+        return;
+    }
+    dirty[faceIdx] = true;
+    dirtyFaces.push_back(faceIdx);
+}
+
+void LightCompositor::composite(uint32_t faceIdx) {
+    auto& face = faces[faceIdx];
+    auto styles = faceStyles[faceIdx];
+    uint32_t size = face.width * face.height;
+
+    // NOTE(jan): A face has one light map per style up to the first unused
+    // one, stored after each other.
+    const uint8_t* layers[MAX_LIGHT_STYLES];
+    uint16_t scales[MAX_LIGHT_STYLES];
+    uint32_t layerCount = 0;
+    for (uint32_t i = 0; i < MAX_LIGHT_STYLES; i++) {
+        auto style = (styles >> (i * 8)) & 0xFF;
+        auto offset = face.offset + i * size;
+        if ((style == LIGHT_STYLE_NONE) ||
+                (offset + size > bsp.lightMap.size())) {
+            break;
+        }
+        if (style >= LIGHT_STYLE_COUNT) {
+            continue;
+        }
+        layers[layerCount] = bsp.lightMap.data() + offset;
+        scales[layerCount] = styleScales[style];
+        layerCount++;
+    }
+
+    auto first = texels.data() + face.y * width + face.x;
+    for (uint32_t y = 0; y < face.height; y++) {
+        auto dst = first + y * width;
+        blendLightRow(dst, layers, scales, layerCount, y * face.width, face.width);
+        for (uint32_t i = 1; i <= LIGHTMAP_BORDER; i++) {
+            dst[-(int32_t)i] = dst[0];
+            dst[face.width - 1 + i] = dst[face.width - 1];
+        }
+    }
+    auto rowSize = face.width + 2 * LIGHTMAP_BORDER;
+    auto top = first - LIGHTMAP_BORDER;
+    auto bottom = top + (face.height - 1) * width;
+    for (uint32_t i = 1; i <= LIGHTMAP_BORDER; i++) {
+        memcpy(top - i * width, top, rowSize);
+        memcpy(bottom + i * width, bottom, rowSize);
+    }
+}
+
+void LightCompositor::update(const float* styleValues) {
+    changedRecords.clear();
+    if (uploading) {
+        if (vkGetFenceStatus(vk.device, fence) != VK_SUCCESS) {
+            return;
+        }
+        VKCHECK(vkResetFences(vk.device, 1, &fence));
+        vkFreeCommandBuffers(vk.device, vk.cmdPoolTransient, 1, &cmd);
+        cmd = VK_NULL_HANDLE;
+        uploading = false;
+    }
+
+    for (uint32_t style = 0; style < LIGHT_STYLE_COUNT; style++) {
+        auto value = std::min(std::max(styleValues[style], 0.f), 1.f);
+        auto scale = (uint16_t)(value * 256.f + .5f);
+        if (scale == styleScales[style]) {
+            continue;
+        }
+        styleScales[style] = scale;
+        for (auto faceIdx: styleFaces[style]) {
+            markDirty(faceIdx);
+        }
+    }
+    if (dirtyFaces.empty()) {
+        return;
+    }
+
+    regions.clear();
+    VkDeviceSize offset = 0;
+    for (auto faceIdx: dirtyFaces) {
+        composite(faceIdx);
+        dirty[faceIdx] = false;
+        changedRecords.push_back(faces[faceIdx].record);
+
+        auto& face = faces[faceIdx];
+        auto x = face.x - LIGHTMAP_BORDER;
+        auto y = face.y - LIGHTMAP_BORDER;
+        auto regionWidth = face.width + 2 * LIGHTMAP_BORDER;
+        auto regionHeight = face.height + 2 * LIGHTMAP_BORDER;
+        for (uint32_t row = 0; row < regionHeight; row++) {
+            memcpy(
+                mappedStaging + offset + row * regionWidth,
+                texels.data() + (y + row) * width + x,
+                regionWidth
+            );
+        }
+
+        auto& region = regions.emplace_back();
+        region = {};
+        region.bufferOffset = offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = { (int32_t)x, (int32_t)y, 0 };
+        region.imageExtent = { regionWidth, regionHeight, 1 };
+
+        offset += alignRegion(regionWidth * regionHeight);
+    }
+    dirtyFaces.clear();
+
+    // NOTE(jan): Submitted on the graphics queue, so the barriers order the
+    // copy after frames already in flight and before later ones.
+    cmd = beginOneShotCommandBuffer(vk);
+    recordTextureArrayRegionCopies(cmd, atlas[0], 0, staging.handle, regions);
+    VKCHECK(vkEndCommandBuffer(cmd));
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmd;
+    VKCHECK(vkQueueSubmit(vk.queue, 1, &submitInfo, fence));
+    uploading = true;
+}
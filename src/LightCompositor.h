@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+
+#include "BSPParser.h"
+#include "Mesh.h"
+#include "VulkanResources.h"
+
+using std::vector;
+
+// NOTE(jan): Styles animated in main.cpp. Faces using higher styles, which are
+// switched by triggers, are composited as if those styles were off.
+const uint32_t LIGHT_STYLE_COUNT = 12;
+const uint32_t LIGHT_STYLE_NONE = 0xFF;
+
+/* NOTE(jan): Keeps the light map atlas lit by the current light styles. Faces
+   store one light map per style, which are blended into the atlas on the CPU
+   at 1/256 precision. Only faces that use a style whose value changed since
+   the last update are blended and uploaded again, so most frames touch no
+   light map data at all. */
+struct LightCompositor {
+    // NOTE(jan): A single layer, in a vector so it binds like texture arrays.
+    vector<VulkanTextureArray> atlas;
+    // NOTE(jan): CPU copy of the atlas, see Mesh::lightMap for the layout.
+    vector<uint8_t> texels;
+    uint32_t width;
+    // NOTE(jan): Face records composited by the last update.
+    vector<uint32_t> changedRecords;
+
+    LightCompositor(Vulkan& vk, BSPParser& bsp, Mesh& mesh);
+    // NOTE(jan): The device must be idle.
+    ~LightCompositor();
+
+    // NOTE(jan): Takes LIGHT_STYLE_COUNT values between 0 and 1. Changes made
+    // while the previous upload is in flight are picked up by a later call.
+    void update(const float* styleValues);
+
+private:
+    Vulkan& vk;
+    BSPParser& bsp;
+    vector<FaceLight> faces;
+    // NOTE(jan): Packed like FaceRecord::lightStyles.
+    vector<uint32_t> faceStyles;
+    vector<uint32_t> styleFaces[LIGHT_STYLE_COUNT];
+    uint16_t styleScales[LIGHT_STYLE_COUNT];
+    vector<bool> dirty;
+    vector<uint32_t> dirtyFaces;
+
+    VulkanBuffer staging;
+    uint8_t* mappedStaging;
+    vector<VkBufferImageCopy> regions;
+    bool uploading;
+    VkCommandBuffer cmd;
+    VkFence fence;
+
+    void markDirty(uint32_t faceIdx);
+    void composite(uint32_t faceIdx);
+};
@@ -1,24 +1,17 @@
+#include <algorithm>
+
+#include <glm/common.hpp>
 #include <glm/geometric.hpp>
 #include <glm/vec2.hpp>
 
+#include "Arena.h"
+#include "JobSystem.h"
 #include "Mesh.h"
 
 using glm::dot;
 using glm::normalize;
 using glm::vec2;
-
-Vertex::Vertex() {
-    pos = {};
-    texCoord = {};
-    texIdx = -1;
-    lightCoord = {};
-    lightIdx = -1;
-    extent = {};
-
-    for (int i = 0; i < MAX_LIGHT_STYLES; i++) {
-        lightStyles[i] = 0xFF;
-    }
-}
+using glm::vec4;
 
 vec2 calculateUV(
     vec3& vertex,
@@ -34,132 +27,518 @@ vec2 calculateUV(
 Mesh::Mesh(BSPParser& bsp):
     bsp(bsp)
 {
-    buildLightMap();
     buildWireFrameModel();
+    buildLightMap();
 }
 
 void Mesh::buildLightMap() {
-    auto count = bsp.lightMap.size();
-    lightMap.resize(count);
+    // NOTE(jan): Shelves pack tightest when the tallest light maps go first.
+    vector<uint32_t> order(faceLights.size());
+    for (uint32_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(
+        order.begin(),
+        order.end(),
+        [this](uint32_t a, uint32_t b) {
+            return faceLights[a].height > faceLights[b].height;
+        }
+    );
+
+    uint32_t shelfX = 0;
+    uint32_t shelfY = 0;
+    uint32_t shelfHeight = 0;
+    auto place = [&](uint32_t width, uint32_t height, uint32_t& x, uint32_t& y) {
+        width += 2 * LIGHTMAP_BORDER;
+        height += 2 * LIGHTMAP_BORDER;
+        if (shelfX + width > LIGHTMAP_ATLAS_WIDTH) {
+            shelfX = 0;
+            shelfY += shelfHeight;
+            shelfHeight = 0;
+        }
+        x = shelfX + LIGHTMAP_BORDER;
+        y = shelfY + LIGHTMAP_BORDER;
+        shelfX += width;
+        shelfHeight = std::max(shelfHeight, height);
+    };
+
+    // NOTE(jan): Faces without a light map all sample this texel, which is
+    // left black along with its border.
+    uint32_t unlitX, unlitY;
+    place(1, 1, unlitX, unlitY);
+    for (auto faceLightIdx: order) {
+        auto& faceLight = faceLights[faceLightIdx];
+        place(faceLight.width, faceLight.height, faceLight.x, faceLight.y);
+    }
+
+    lightMapWidth = LIGHTMAP_ATLAS_WIDTH;
+    lightMapHeight = shelfY + shelfHeight;
+    if (lightMapHeight > LIGHTMAP_ATLAS_MAX_HEIGHT) {
+        throw runtime_error("light map atlas is full");
+    }
+    lightMap.assign(lightMapWidth * lightMapHeight, 0);
+
+    auto border = (int32_t)LIGHTMAP_BORDER;
+    for (auto& faceLight: faceLights) {
+        auto width = (int32_t)faceLight.width;
+        auto height = (int32_t)faceLight.height;
+        auto src = bsp.lightMap.data() + faceLight.offset;
+        for (int32_t y = -border; y < height + border; y++) {
+            auto srcY = glm::clamp(y, 0, height - 1);
+            auto dst = lightMap.data() +
+                (faceLight.y + y) * lightMapWidth + faceLight.x;
+            for (int32_t x = -border; x < width + border; x++) {
+                auto srcX = glm::clamp(x, 0, width - 1);
+                dst[x] = src[srcY * width + srcX];
+            }
+        }
+    }
+
+    vec2 atlasScale = { 1.f / lightMapWidth, 1.f / lightMapHeight };
+    for (auto& record: faceRecords) {
+        record.lightScale = { 0.f, 0.f };
+        record.scale.z = (unlitX + .5f) * atlasScale.x;
+        record.scale.w = (unlitY + .5f) * atlasScale.y;
+    }
+    // NOTE(jan): Texel centres are at half coordinates, so a light map
+    // coordinate of 0 lands on the centre of the face's first texel.
+    for (auto& faceLight: faceLights) {
+        auto& record = faceRecords[faceLight.record];
+        vec2 origin = vec2(faceLight.x, faceLight.y) + .5f - faceLight.uvMin;
+        record.lightScale = atlasScale;
+        record.scale.z = origin.x * atlasScale.x;
+        record.scale.w = origin.y * atlasScale.y;
+    }
+}
+
+// NOTE(jan): Puts two zero bits between each of the low 10 bits.
+static uint32_t spreadBits(uint32_t v) {
+    v &= 0x3FF;
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+static uint32_t mortonCode(vec3 point, BoundingBox& bounds) {
+    vec3 extent = glm::max(bounds.max - bounds.min, vec3(1.f));
+    vec3 cell = glm::clamp((point - bounds.min) / extent, 0.f, 1.f) * 1023.f;
+    return spreadBits((uint32_t)cell.x) |
+        (spreadBits((uint32_t)cell.y) << 1) |
+        (spreadBits((uint32_t)cell.z) << 2);
+}
 
-    for (unsigned i = 0; i < count; i++) {
-        lightMap[i] = bsp.lightMap[i] / 255.f;
+vec3 Mesh::faceCentre(Face& face) {
+    vec3 sum(0.f);
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < face.ledgeNum; i++) {
+        auto edgeId = bsp.edgeList[face.ledgeId + i];
+        Edge& edge = bsp.edges[abs(edgeId)];
+        if (edgeId < 0) {
+            sum += bsp.vertices[edge.v1];
+            count++;
+        } else if (edgeId > 0) {
+            sum += bsp.vertices[edge.v0];
+            count++;
+        }
     }
+    return count ? sum / (float)count : sum;
+}
+
+uint32_t Mesh::countCorners(Face& face) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < face.ledgeNum; i++) {
+        if (bsp.edgeList[face.ledgeId + i] != 0) {
+            count++;
+        }
+    }
+    return count;
 }
 
 void Mesh::buildWireFrameModel() {
-    for (auto& model: bsp.models) {
+    vector<FacePlacement> placements;
+    placements.reserve(bsp.faces.size());
+    uint32_t maxEdges = 0;
+    for (uint32_t modelIdx = 0; modelIdx < bsp.models.size(); modelIdx++) {
+        auto& model = bsp.models[modelIdx];
         auto firstFace = model.faceID;
         auto lastFace = firstFace + model.faceCount;
 
         for (int faceIdx = firstFace; faceIdx < lastFace; faceIdx++) {
             auto& face = bsp.faces[faceIdx];
-
             auto& texInfo = bsp.texInfos[face.texinfoId];
-            auto& texID = texInfo.textureID;
-            auto texType = bsp.textures->texTypes[texID];
-            if (texType == TEXTYPE::DEBUG) {
+            auto texRecord = bsp.textures->records[texInfo.textureID];
+            if (texRecord.type == TEXTYPE::DEBUG) {
                 continue;
             }
-            auto& texHeader = bsp.textures->textureHeaders[texInfo.textureID];
-
-            vector<vec3> faceCoords;
-            auto edgeListBaseId = face.ledgeId;
-            for (uint32_t i = 0; i < face.ledgeNum; i++) {
-                auto edgeListId = edgeListBaseId + i;
-                auto edgeId = bsp.edgeList[edgeListId];
-                Edge& edge = bsp.edges[abs(edgeId)];
-                vec3 v0 = bsp.vertices[edge.v0];
-                vec3 v1 = bsp.vertices[edge.v1];
-                if (edgeId < 0) {
-                    faceCoords.push_back(v1);
-                    faceCoords.push_back(v0);
-                } else if (edgeId > 0) {
-                    faceCoords.push_back(v0);
-                    faceCoords.push_back(v1);
-                }
+
+            auto& placement = placements.emplace_back();
+            placement.faceIdx = faceIdx;
+            placement.type = texRecord.type;
+            placement.model = modelIdx;
+            placement.texSlot = texRecord.slot;
+            placement.corners = countCorners(face);
+            placement.morton = mortonCode(faceCentre(face), model.bounds);
+            maxEdges = std::max(maxEdges, (uint32_t)face.ledgeNum);
+        }
+    }
+
+    // NOTE(jan): Grouping faces by model and texture turns every texture of a
+    // model into a single draw. Within a group faces follow a Morton curve
+    // through the model, so the runs buildClusters cuts are compact and cull
+    // well. The sort is stable so faces at the same point keep their BSP
+    // order.
+    std::stable_sort(
+        placements.begin(),
+        placements.end(),
+        [](const FacePlacement& a, const FacePlacement& b) {
+            if (a.type != b.type) {
+                return a.type < b.type;
+            }
+            if (a.model != b.model) {
+                return a.model < b.model;
+            }
+            if (a.texSlot != b.texSlot) {
+                return a.texSlot < b.texSlot;
             }
+            return a.morton < b.morton;
+        }
+    );
+
+    // NOTE(jan): A prefix sum over the sorted faces gives every face a fixed
+    // place in each output, so faces can be built in any order and still
+    // produce the same bytes as a serial build.
+    uint32_t vertexCounts[3] = {};
+    uint32_t indexCounts[3] = {};
+    uint32_t tableCount = 0;
+    uint32_t lightCount = 0;
+    modelRanges.resize(bsp.models.size(), {});
+    for (uint32_t i = 0; i < placements.size(); i++) {
+        auto& placement = placements[i];
+        auto texType = placement.type;
+        auto corners = placement.corners;
+        placement.firstVertex = vertexCounts[texType];
+        placement.firstIndex = indexCounts[texType];
+        placement.record = i;
+        placement.tableIdx = texType == TEXTYPE::DEFAULT ?
+            tableCount++ : FACE_TABLE_NONE;
+        placement.light = bsp.faces[placement.faceIdx].lightmap != -1 ?
+            lightCount++ : FACE_LIGHT_NONE;
+
+        vertexCounts[texType] += corners;
+        uint32_t indexCount = corners > 2 ? (corners - 2) * 3 : 0;
+        indexCounts[texType] += indexCount;
 
-            Vertex v0, v1, v2;
-
-            auto texNum = bsp.textures->texNums[texID];
-            v0.texIdx = texNum;
-            v1.texIdx = texNum;
-            v2.texIdx = texNum;
-
-            auto& p0 = faceCoords[0];
-            v0.pos = p0;
-            v0.texCoord = calculateUV(v0.pos, texInfo);
-            v0.lightCoord = {0, 0};
-            v0.lightIdx = -1;
-
-            vector<Vertex> faceVertices;
-            for (uint32_t i = 1; i < face.ledgeNum; i++) {
-                faceVertices.push_back(v0);
-
-                v1.pos = faceCoords[i*2];
-                v1.texCoord = calculateUV(v1.pos, texInfo);
-                v1.lightCoord = {0, 0};
-                v1.lightIdx = -1;
-                faceVertices.push_back(v1);
-
-                v2.pos = faceCoords[i*2+1];
-                v2.texCoord = calculateUV(v2.pos, texInfo);
-                v2.lightCoord = {0, 0};
-                v2.lightIdx = -1;
-                faceVertices.push_back(v2);
+        if (texType == TEXTYPE::FLUID) {
+            auto& previous = placements[i > 0 ? i - 1 : 0];
+            if (fluidDraws.empty() ||
+                    (previous.model != placement.model) ||
+                    (previous.texSlot != placement.texSlot)) {
+                auto& draw = fluidDraws.emplace_back();
+                draw = {};
+                draw.instanceCount = 1;
+                draw.firstIndex = placement.firstIndex;
             }
+            fluidDraws.back().indexCount += indexCount;
+        }
+        if (texType != TEXTYPE::DEFAULT) {
+            continue;
+        }
+        if (drawRanges.empty() ||
+                (drawRanges.back().model != placement.model) ||
+                (drawRanges.back().texSlot != placement.texSlot)) {
+            auto& modelRange = modelRanges[placement.model];
+            if (modelRange.drawCount == 0) {
+                modelRange.firstDraw = drawRanges.size();
+            }
+            modelRange.drawCount++;
+
+            auto& range = drawRanges.emplace_back();
+            range.texSlot = placement.texSlot;
+            range.model = placement.model;
+            range.firstFace = placement.tableIdx;
+            range.faceCount = 0;
+        }
+        drawRanges.back().faceCount++;
+    }
 
-            for (auto& vertex: faceVertices) {
-                vertex.lightStyles[0] = face.typeLight;
-                vertex.lightStyles[1] = face.baseLight;
-                vertex.lightStyles[2] = face.light[0];
-                vertex.lightStyles[3] = face.light[1];
+    vector<Vertex>* outVertices[] = { &vertices, &skyVertices, &fluidVertices };
+    vector<uint32_t>* outIndices[] = { &indices, &skyIndices, &fluidIndices };
+    for (int type = 0; type < 3; type++) {
+        outVertices[type]->resize(vertexCounts[type]);
+        outIndices[type]->resize(indexCounts[type]);
+    }
+    faceRecords.resize(placements.size());
+    faceTable.resize(tableCount);
+    faceLights.resize(lightCount);
+
+    auto& jobs = getJobSystem();
+    JobCounter builds;
+    auto scratchSize = maxEdges * sizeof(vec3) + alignof(vec3);
+    for (size_t first = 0; first < placements.size(); first += MESH_BUILD_BATCH) {
+        auto last = std::min(first + MESH_BUILD_BATCH, placements.size());
+        jobs.submit(builds, [this, &placements, first, last, scratchSize]() {
+            Arena scratch(scratchSize);
+            for (auto i = first; i < last; i++) {
+                scratch.reset();
+                buildFace(placements[i], scratch);
             }
+        });
+    }
+    jobs.wait(builds);
+    buildClusters(placements);
 
-            if (face.lightmap != -1) {
-                vec2 uvMin = faceVertices[0].texCoord;
-                vec2 uvMax = faceVertices[0].texCoord;
-                for (auto& v: faceVertices) {
-                    auto& uv = v.texCoord;
-                    if (uv.x < uvMin.x) uvMin.x = uv.x;
-                    if (uv.y < uvMin.y) uvMin.y = uv.y;
-                    if (uv.x > uvMax.x) uvMax.x = uv.x;
-                    if (uv.y > uvMax.y) uvMax.y = uv.y;
-                }
-                // NOTE(jan): gl_model.c:1049--1050
-                uvMin.x = floor(uvMin.x / 16);
-                uvMin.y = floor(uvMin.y / 16);
-                uvMax.x = ceil(uvMax.x / 16);
-                uvMax.y = ceil(uvMax.y / 16);
-
-                vec2 extent = {
-                    int(uvMax.x - uvMin.x) + 1,
-                    int(uvMax.y - uvMin.y) + 1
-                };
-
-                for (auto& v: faceVertices) {
-                    auto& uv = v.texCoord;
-                    v.lightCoord.s = (uv.x/16) - uvMin.x;
-                    v.lightCoord.t = (uv.y/16) - uvMin.y;
-                    v.lightIdx = face.lightmap;
-                    v.extent = extent;
+    for (auto& range: drawRanges) {
+        range.min = faceTable.min(range.firstFace);
+        range.max = faceTable.max(range.firstFace);
+        for (uint32_t i = 1; i < range.faceCount; i++) {
+            auto face = range.firstFace + i;
+            range.min = glm::min(range.min, faceTable.min(face));
+            range.max = glm::max(range.max, faceTable.max(face));
+        }
+    }
+    for (auto& modelRange: modelRanges) {
+        if (modelRange.drawCount == 0) {
+            continue;
+        }
+        auto& first = drawRanges[modelRange.firstDraw];
+        modelRange.min = first.min;
+        modelRange.max = first.max;
+        for (uint32_t i = 1; i < modelRange.drawCount; i++) {
+            auto& range = drawRanges[modelRange.firstDraw + i];
+            modelRange.min = glm::min(modelRange.min, range.min);
+            modelRange.max = glm::max(modelRange.max, range.max);
+        }
+    }
+}
+
+void FaceTable::resize(uint32_t faceCount) {
+    count = faceCount;
+    auto padded = faceCount + 3;
+    // NOTE(jan): Padding faces have every point behind their plane.
+    planeX.assign(padded, 0.f);
+    planeY.assign(padded, 0.f);
+    planeZ.assign(padded, 0.f);
+    planeW.assign(padded, -1.f);
+    for (auto field: { &minX, &minY, &minZ, &maxX, &maxY, &maxZ }) {
+        field->assign(padded, 0.f);
+    }
+    texSlots.assign(padded, 0);
+    records.assign(padded, 0);
+    lights.assign(padded, FACE_LIGHT_NONE);
+}
+
+void Mesh::buildClusters(vector<FacePlacement>& placements) {
+    vector<FacePlacement*> tablePlacements(faceTable.count);
+    for (auto& placement: placements) {
+        if (placement.tableIdx != FACE_TABLE_NONE) {
+            tablePlacements[placement.tableIdx] = &placement;
+        }
+    }
+
+    // NOTE(jan): Faces in a range are in Morton order, see
+    // buildWireFrameModel, so each run of faces is a compact region. Runs are
+    // filled up to the maximum, and the last run of a range takes faces from
+    // the one before it until both reach the minimum.
+    vector<uint32_t> starts;
+    vector<uint32_t> faceTriangles;
+    for (auto& range: drawRanges) {
+        faceTriangles.resize(range.faceCount);
+        for (uint32_t i = 0; i < range.faceCount; i++) {
+            auto& placement = *tablePlacements[range.firstFace + i];
+            faceTriangles[i] = placement.corners > 2 ?
+                placement.corners - 2 : 0;
+        }
+
+        starts.clear();
+        uint32_t triangles = 0;
+        uint32_t previous = 0;
+        for (uint32_t i = 0; i < range.faceCount; i++) {
+            if (starts.empty() ||
+                    (triangles + faceTriangles[i] > CLUSTER_MAX_TRIANGLES)) {
+                starts.push_back(i);
+                previous = triangles;
+                triangles = 0;
+            }
+            triangles += faceTriangles[i];
+        }
+        if ((starts.size() > 1) && (triangles < CLUSTER_MIN_TRIANGLES)) {
+            if (previous + triangles <= CLUSTER_MAX_TRIANGLES) {
+                starts.pop_back();
+            } else {
+                auto& start = starts.back();
+                while ((triangles < CLUSTER_MIN_TRIANGLES) &&
+                        (previous - faceTriangles[start - 1] >=
+                            CLUSTER_MIN_TRIANGLES)) {
+                    start--;
+                    previous -= faceTriangles[start];
+                    triangles += faceTriangles[start];
                 }
             }
+        }
 
-            for (auto& v: faceVertices) {
-                auto& uv = v.texCoord;
-                uv.x /= texHeader.width;
-                uv.y /= texHeader.height;
-
-                if (texType == TEXTYPE::SKY) {
-                    skyVertices.push_back(v);
-                } else if (texType == TEXTYPE::FLUID) {
-                    fluidVertices.push_back(v);
-                } else {
-                    vertices.push_back(v);
-                }
+        range.firstCluster = clusters.size();
+        range.clusterCount = starts.size();
+        for (uint32_t i = 0; i < starts.size(); i++) {
+            auto end = i + 1 < starts.size() ? starts[i + 1] : range.faceCount;
+            auto& placement = *tablePlacements[range.firstFace + starts[i]];
+            auto& cluster = clusters.emplace_back();
+            cluster.firstFace = range.firstFace + starts[i];
+            cluster.faceCount = end - starts[i];
+            auto& draw = draws.emplace_back();
+            draw.indexCount = 0;
+            draw.instanceCount = 1;
+            draw.firstIndex = placement.firstIndex;
+            draw.vertexOffset = 0;
+            draw.firstInstance = 0;
+            for (auto face = starts[i]; face < end; face++) {
+                draw.indexCount += faceTriangles[face] * 3;
+            }
+        }
+    }
+
+    for (auto& cluster: clusters) {
+        cluster.min = faceTable.min(cluster.firstFace);
+        cluster.max = faceTable.max(cluster.firstFace);
+        for (uint32_t i = 1; i < cluster.faceCount; i++) {
+            auto face = cluster.firstFace + i;
+            cluster.min = glm::min(cluster.min, faceTable.min(face));
+            cluster.max = glm::max(cluster.max, faceTable.max(face));
+        }
+
+        vec3 centre = (cluster.min + cluster.max) * .5f;
+        float radius = 0.f;
+        vec3 normalSum = vec3(0.f);
+        vector<vec3> normals(cluster.faceCount);
+        for (uint32_t i = 0; i < cluster.faceCount; i++) {
+            auto& placement = *tablePlacements[cluster.firstFace + i];
+            for (uint32_t j = 0; j < placement.corners; j++) {
+                auto& vertex = vertices[placement.firstVertex + j];
+                radius = std::max(radius, glm::distance(centre, vertex.pos));
             }
+            normals[i] = faceTable.normal(cluster.firstFace + i);
+            normalSum += normals[i];
+        }
+        cluster.sphere = vec4(centre, radius);
+
+        // NOTE(jan): Opposing faces cancel out, and leave no axis to cull by.
+        cluster.cone = { 0.f, 0.f, 1.f, 1.f };
+        if (glm::length(normalSum) < .001f) {
+            continue;
+        }
+        vec3 axis = normalize(normalSum);
+        float minDot = 1.f;
+        for (auto& normal: normals) {
+            minDot = std::min(minDot, dot(axis, normal));
+        }
+        if (minDot > 0.f) {
+            cluster.cone = vec4(axis, sqrt(1.f - minDot * minDot));
+        }
+    }
+}
+
+void Mesh::buildFace(FacePlacement& placement, Arena& scratch) {
+    auto& face = bsp.faces[placement.faceIdx];
+    auto& texInfo = bsp.texInfos[face.texinfoId];
+    auto texRecord = bsp.textures->records[texInfo.textureID];
+    auto texType = placement.type;
+    auto& texHeader = bsp.textures->textureHeaders[texInfo.textureID];
+
+    // NOTE(jan): Each edge is shared with a neighbouring face, so the polygon
+    // is made up of the first vertex of every edge.
+    auto faceCoords = scratch.alloc<vec3>(face.ledgeNum);
+    uint32_t cornerCount = 0;
+    auto edgeListBaseId = face.ledgeId;
+    for (uint32_t i = 0; i < face.ledgeNum; i++) {
+        auto edgeListId = edgeListBaseId + i;
+        auto edgeId = bsp.edgeList[edgeListId];
+        Edge& edge = bsp.edges[abs(edgeId)];
+        if (edgeId < 0) {
+            faceCoords[cornerCount++] = bsp.vertices[edge.v1];
+        } else if (edgeId > 0) {
+            faceCoords[cornerCount++] = bsp.vertices[edge.v0];
         }
     }
+
+    auto tableIdx = placement.tableIdx;
+    if (tableIdx != FACE_TABLE_NONE) {
+        vec3 min = faceCoords[0];
+        vec3 max = faceCoords[0];
+        for (uint32_t i = 0; i < cornerCount; i++) {
+            min = glm::min(min, faceCoords[i]);
+            max = glm::max(max, faceCoords[i]);
+        }
+        auto& plane = bsp.planes[face.planeId];
+        float side = face.side ? -1.f : 1.f;
+        faceTable.planeX[tableIdx] = plane.normal.x * side;
+        faceTable.planeY[tableIdx] = plane.normal.y * side;
+        faceTable.planeZ[tableIdx] = plane.normal.z * side;
+        faceTable.planeW[tableIdx] = -plane.dist * side;
+        faceTable.minX[tableIdx] = min.x;
+        faceTable.minY[tableIdx] = min.y;
+        faceTable.minZ[tableIdx] = min.z;
+        faceTable.maxX[tableIdx] = max.x;
+        faceTable.maxY[tableIdx] = max.y;
+        faceTable.maxZ[tableIdx] = max.z;
+        faceTable.texSlots[tableIdx] = texRecord.slot;
+        faceTable.records[tableIdx] = placement.record;
+        faceTable.lights[tableIdx] = placement.light;
+    }
+
+    auto& record = faceRecords[placement.record];
+    record.uVector = vec4(texInfo.uVector, texInfo.uOffset);
+    record.vVector = vec4(texInfo.vVector, texInfo.vOffset);
+    record.scale = {
+        1.f / texHeader.width,
+        1.f / texHeader.height,
+        0.f,
+        0.f
+    };
+    record.texSlot = texRecord.slot;
+    record.model = placement.model;
+    record.lightStyles = (uint32_t)face.typeLight |
+        ((uint32_t)face.baseLight << 8) |
+        ((uint32_t)face.light[0] << 16) |
+        ((uint32_t)face.light[1] << 24);
+
+    if (placement.light != FACE_LIGHT_NONE) {
+        vec2 uvMin = calculateUV(faceCoords[0], texInfo);
+        vec2 uvMax = uvMin;
+        for (uint32_t i = 0; i < cornerCount; i++) {
+            auto uv = calculateUV(faceCoords[i], texInfo);
+            if (uv.x < uvMin.x) uvMin.x = uv.x;
+            if (uv.y < uvMin.y) uvMin.y = uv.y;
+            if (uv.x > uvMax.x) uvMax.x = uv.x;
+            if (uv.y > uvMax.y) uvMax.y = uv.y;
+        }
+        // NOTE(jan): gl_model.c:1049--1050
+        uvMin.x = floor(uvMin.x / 16);
+        uvMin.y = floor(uvMin.y / 16);
+        uvMax.x = ceil(uvMax.x / 16);
+        uvMax.y = ceil(uvMax.y / 16);
+
+        auto& faceLight = faceLights[placement.light];
+        faceLight.record = placement.record;
+        faceLight.offset = face.lightmap;
+        faceLight.width = int(uvMax.x - uvMin.x) + 1;
+        faceLight.height = int(uvMax.y - uvMin.y) + 1;
+        faceLight.uvMin = uvMin;
+    }
+
+    vector<Vertex>* outVertices[] = { &vertices, &skyVertices, &fluidVertices };
+    vector<uint32_t>* outIndices[] = { &indices, &skyIndices, &fluidIndices };
+    auto typeVertices = outVertices[texType]->data();
+    auto baseVertex = placement.firstVertex;
+    for (uint32_t i = 0; i < cornerCount; i++) {
+        typeVertices[baseVertex + i] = { faceCoords[i], placement.record };
+    }
+    // NOTE(jan): Faces are convex, so a fan around the first vertex covers
+    // them in n - 2 triangles.
+    auto dst = outIndices[texType]->data() + placement.firstIndex;
+    for (uint32_t i = 1; i + 1 < cornerCount; i++) {
+        *dst++ = baseVertex;
+        *dst++ = baseVertex + i;
+        *dst++ = baseVertex + i + 1;
+    }
 }
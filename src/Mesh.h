@@ -3,6 +3,7 @@
 #include <vector>
 
 #include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
 
 #include "BSPParser.h"
 
@@ -12,27 +13,206 @@ using std::vector;
 
 const int MAX_LIGHT_STYLES = 4;
 
+// NOTE(jan): Everything but the position is constant across a face, and
+// lives in the face's record.
 struct Vertex {
     glm::vec3 pos;
-    glm::vec2 texCoord;
-    uint32_t texIdx;
-    glm::vec2 lightCoord;
-    int32_t lightIdx;
-    int32_t lightStyles[MAX_LIGHT_STYLES];
-    glm::vec2 extent;
+    uint32_t faceIdx;
+};
+
+// NOTE(jan): Laid out to match FaceRecord in faces.glsl, which follows std430
+// rules and pads the struct to a multiple of 16 bytes.
+struct FaceRecord {
+    // NOTE(jan): Texture axes, with the offset in w.
+    glm::vec4 uVector;
+    glm::vec4 vVector;
+    // NOTE(jan): Reciprocal texture size in xy, light map atlas offset in zw.
+    glm::vec4 scale;
+    // NOTE(jan): Light map texels to atlas coordinates, zero for faces
+    // without a light map so they all sample the same black texel.
+    glm::vec2 lightScale;
+    uint32_t texSlot;
+    // NOTE(jan): One byte per style, 0xFF when unused.
+    uint32_t lightStyles;
+    // NOTE(jan): Index into the model transforms, see RenderLevel.
+    uint32_t model;
+    uint32_t padding[3];
+};
+
+/* NOTE(jan): Default faces in model space, with one array per field so that
+   culling only reads what it tests, four faces at a time. Three faces that
+   always face away follow the last one, so a group of four starting at any
+   face never reads past the end. See cullFaces. */
+struct FaceTable {
+    uint32_t count;
+    // NOTE(jan): Planes with the normal out of the visible side, so
+    // Face::side is already applied. A point p is in front when
+    // dot(normal, p) + w > 0.
+    vector<float> planeX;
+    vector<float> planeY;
+    vector<float> planeZ;
+    vector<float> planeW;
+    vector<float> minX;
+    vector<float> minY;
+    vector<float> minZ;
+    vector<float> maxX;
+    vector<float> maxY;
+    vector<float> maxZ;
+    vector<uint32_t> texSlots;
+    vector<uint32_t> records;
+    // NOTE(jan): Index into Mesh::faceLights, which holds the light map's
+    // rectangle in the atlas, or FACE_LIGHT_NONE.
+    vector<uint32_t> lights;
+
+    void resize(uint32_t faceCount);
+
+    glm::vec3 min(uint32_t face) const {
+        return { minX[face], minY[face], minZ[face] };
+    }
+    glm::vec3 max(uint32_t face) const {
+        return { maxX[face], maxY[face], maxZ[face] };
+    }
+    glm::vec3 normal(uint32_t face) const {
+        return { planeX[face], planeY[face], planeZ[face] };
+    }
+};
+
+// NOTE(jan): The atlas grows in height as faces are packed into it.
+const uint32_t LIGHTMAP_ATLAS_WIDTH = 1024;
+const uint32_t LIGHTMAP_ATLAS_MAX_HEIGHT = 4096;
+// NOTE(jan): Copies of the edge texels around each light map, so filtering
+// never reads a neighbouring face.
+const uint32_t LIGHTMAP_BORDER = 1;
+
+// NOTE(jan): A face's light map and where it lives in the atlas.
+struct FaceLight {
+    uint32_t record;
+    // NOTE(jan): Offset of the first style in BSPParser::lightMap.
+    uint32_t offset;
+    uint32_t width;
+    uint32_t height;
+    // NOTE(jan): In light map texels, see gl_model.c:1049--1050.
+    glm::vec2 uvMin;
+    // NOTE(jan): First texel inside the border.
+    uint32_t x;
+    uint32_t y;
+};
+
+// NOTE(jan): Faces per job when building in parallel.
+const size_t MESH_BUILD_BATCH = 256;
+const uint32_t FACE_TABLE_NONE = 0xFFFFFFFF;
+const uint32_t FACE_LIGHT_NONE = 0xFFFFFFFF;
 
-    Vertex();
+// NOTE(jan): Matches VkDrawIndexedIndirectCommand.
+struct IndexedDraw {
+    uint32_t indexCount;
+    uint32_t instanceCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t firstInstance;
 };
 
+// NOTE(jan): Faces are never split, so a face with more triangles than the
+// maximum gets a cluster of its own. Only ranges with fewer triangles than
+// the minimum have smaller clusters.
+const uint32_t CLUSTER_MIN_TRIANGLES = 64;
+const uint32_t CLUSTER_MAX_TRIANGLES = 128;
+
+// NOTE(jan): A run of faces in a draw range with one draw of its own, so it
+// can be culled on its own. In model space. Faces within a range are in
+// Morton order, so a run is a compact region of the model.
+struct Cluster {
+    glm::vec3 min;
+    glm::vec3 max;
+    // NOTE(jan): Centre in xyz, radius in w.
+    glm::vec4 sphere;
+    // NOTE(jan): Average face normal in xyz, and in w the sine of the largest
+    // angle between it and a face normal. 1 when the cone never culls.
+    glm::vec4 cone;
+    uint32_t firstFace;
+    uint32_t faceCount;
+};
+
+// NOTE(jan): Faces of one texture in one model, in model space.
+struct DrawRange {
+    glm::vec3 min;
+    glm::vec3 max;
+    uint32_t texSlot;
+    uint32_t model;
+    uint32_t firstFace;
+    uint32_t faceCount;
+    uint32_t firstCluster;
+    uint32_t clusterCount;
+};
+
+// NOTE(jan): Model 0 is the world, the rest are brush entities such as doors
+// and lifts, which can move independently.
+struct ModelRange {
+    glm::vec3 min;
+    glm::vec3 max;
+    uint32_t firstDraw;
+    uint32_t drawCount;
+};
+
+// NOTE(jan): Where a face's output goes, see Mesh::buildWireFrameModel.
+struct FacePlacement {
+    uint32_t faceIdx;
+    TEXTYPE type;
+    uint32_t model;
+    uint32_t texSlot;
+    uint32_t corners;
+    // NOTE(jan): Of the face's centre within its model's bounds.
+    uint32_t morton;
+    uint32_t firstVertex;
+    uint32_t firstIndex;
+    uint32_t record;
+    uint32_t tableIdx;
+    uint32_t light;
+};
+
+struct Arena;
+
 // TODO(jan): rename to "model" put textures, lightmaps, vertices &c in here
 struct Mesh {
     BSPParser& bsp;
+    // NOTE(jan): One vertex per polygon corner, with triangles in the index
+    // lists. Each face is a fan over vertices no other face uses, which the
+    // vertex cache already handles as well as it can, so unlike alias models
+    // the indices are not reordered.
     vector<Vertex> vertices;
     vector<Vertex> skyVertices;
     vector<Vertex> fluidVertices;
-    vector<float> lightMap;
+    vector<uint32_t> indices;
+    vector<uint32_t> skyIndices;
+    vector<uint32_t> fluidIndices;
+    // NOTE(jan): Shared by the default, sky and fluid vertices.
+    vector<FaceRecord> faceRecords;
+    // NOTE(jan): R8 atlas of every face's light map.
+    vector<uint8_t> lightMap;
+    uint32_t lightMapWidth;
+    uint32_t lightMapHeight;
+    vector<FaceLight> faceLights;
+    // NOTE(jan): Only faces with default textures.
+    FaceTable faceTable;
+    // NOTE(jan): Default faces are sorted by model and then by texture, with
+    // one range per texture in each model. Ranges are split into clusters,
+    // with one draw per cluster.
+    vector<DrawRange> drawRanges;
+    vector<Cluster> clusters;
+    vector<IndexedDraw> draws;
+    // NOTE(jan): One per BSP model, covering its default faces.
+    vector<ModelRange> modelRanges;
+    // NOTE(jan): One per texture in each model, so that every fluid draw
+    // samples a single texture array, like the default draws.
+    vector<IndexedDraw> fluidDraws;
 
     Mesh(BSPParser& BSPParser);
     void buildLightMap();
     void buildWireFrameModel();
+
+private:
+    uint32_t countCorners(Face& face);
+    vec3 faceCentre(Face& face);
+    void buildFace(FacePlacement& placement, Arena& scratch);
+    void buildClusters(vector<FacePlacement>& placements);
 };
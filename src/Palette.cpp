@@ -6,3 +6,14 @@ Palette::Palette(FILE* file, int32_t offset, int32_t size) {
     colors.resize(size / 3);
     fread_s(colors.data(), size, size, 1, file);
 }
+
+void Palette::expand(const uint8_t* indices, uint32_t count, uint8_t* texels) {
+    for (uint32_t i = 0; i < count; i++) {
+        auto colorIdx = indices[i];
+        auto& paletteColor = colors[colorIdx];
+        texels[i*4] = paletteColor.r;
+        texels[i*4+1] = paletteColor.g;
+        texels[i*4+2] = paletteColor.b;
+        texels[i*4+3] = colorIdx >= FULLBRIGHT_START ? 0 : 255;
+    }
+}
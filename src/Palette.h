@@ -15,8 +15,15 @@ struct PaletteColor {
     uint8_t b;
 };
 
+// NOTE(jan): Palette indices from here on are drawn at full brightness.
+const uint8_t FULLBRIGHT_START = 224;
+
 struct Palette {
     vector<PaletteColor> colors;
 
     Palette(FILE*, int32_t offset, int32_t size);
+
+    // NOTE(jan): Writes RGBA texels with alpha cleared on fullbrights, so
+    // textures without any stay opaque and can be stored as BC1.
+    void expand(const uint8_t* indices, uint32_t count, uint8_t* texels);
 };
@@ -0,0 +1,86 @@
+#include "Presenter.h"
+
+void Presenter::init(Vulkan& vk) {
+    image = 0;
+    frame = 0;
+    imageFences.assign(vk.swap.images.size(), VK_NULL_HANDLE);
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    for (uint32_t i = 0; i < FRAMES_IN_FLIGHT; i++) {
+        VKCHECK(vkCreateSemaphore(
+            vk.device,
+            &semaphoreInfo,
+            nullptr,
+            &imageReady[i]
+        ));
+        VKCHECK(vkCreateSemaphore(
+            vk.device,
+            &semaphoreInfo,
+            nullptr,
+            &renderDone[i]
+        ));
+        VKCHECK(vkCreateFence(vk.device, &fenceInfo, nullptr, &fences[i]));
+    }
+}
+
+void Presenter::acquire(Vulkan& vk) {
+    auto fence = fences[frame];
+    VKCHECK(vkWaitForFences(vk.device, 1, &fence, VK_TRUE, UINT64_MAX));
+    VKCHECK(vkAcquireNextImageKHR(
+        vk.device,
+        vk.swap.handle,
+        UINT64_MAX,
+        imageReady[frame],
+        VK_NULL_HANDLE,
+        &image
+    ));
+    // NOTE(jan): The image's blocks are only free once the frame that last
+    // rendered to it has finished.
+    auto& imageFence = imageFences[image];
+    if ((imageFence != VK_NULL_HANDLE) && (imageFence != fence)) {
+        VKCHECK(vkWaitForFences(
+            vk.device,
+            1,
+            &imageFence,
+            VK_TRUE,
+            UINT64_MAX
+        ));
+    }
+    imageFence = fence;
+    VKCHECK(vkResetFences(vk.device, 1, &fence));
+}
+
+void Presenter::present(Vulkan& vk, VkCommandBuffer* cmds, uint32_t count) {
+    VkPipelineStageFlags waitStage =
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &imageReady[frame];
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = count;
+    submitInfo.pCommandBuffers = cmds + image * count;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &renderDone[frame];
+    VKCHECK(vkQueueSubmit(vk.queue, 1, &submitInfo, fences[frame]));
+
+    VkPresentInfoKHR presentInfo = {};
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &renderDone[frame];
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = &vk.swap.handle;
+    presentInfo.pImageIndices = &image;
+    VKCHECK(vkQueuePresentKHR(vk.queue, &presentInfo));
+
+    frame = (frame + 1) % FRAMES_IN_FLIGHT;
+}
+
+Presenter& getPresenter() {
+    static Presenter presenter;
+    return presenter;
+}
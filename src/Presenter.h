@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+
+#include "Vulkan.h"
+
+using std::vector;
+
+// NOTE(jan): How many frames the CPU can submit before it waits on the GPU.
+const uint32_t FRAMES_IN_FLIGHT = 2;
+
+/* NOTE(jan): Acquires, submits and presents swap images itself, rather than
+   through present(), so that a frame knows which image it renders to before
+   it writes its data, see UniformRing.h. Every frame in flight has its own
+   semaphores and fence. An image can come back while the frame that last
+   used it is still in flight, so acquire also waits for that frame. */
+struct Presenter {
+    // NOTE(jan): Image of the frame being prepared, set by acquire.
+    uint32_t image;
+
+    void init(Vulkan& vk);
+    // NOTE(jan): Call once per frame, before writing any of its data.
+    void acquire(Vulkan& vk);
+    // NOTE(jan): Like present(), cmds holds count command buffers for every
+    // image, and only the acquired image's are submitted.
+    void present(Vulkan& vk, VkCommandBuffer* cmds, uint32_t count);
+
+private:
+    VkSemaphore imageReady[FRAMES_IN_FLIGHT];
+    VkSemaphore renderDone[FRAMES_IN_FLIGHT];
+    VkFence fences[FRAMES_IN_FLIGHT];
+    // NOTE(jan): Fence of the last frame that rendered to each image.
+    vector<VkFence> imageFences;
+    uint32_t frame;
+};
+
+Presenter& getPresenter();
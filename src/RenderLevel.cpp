@@ -1,7 +1,136 @@
 #pragma warning(disable: 4267)
 
+#include <algorithm>
+
+#include <glm/matrix.hpp>
+
 #include "RenderLevel.h"
 #include "Mesh.h"
+#include "Frustum.h"
+#include "LightCompositor.h"
+#include "SurfaceCache.h"
+#include "TexturePacker.h"
+#include "TextureRegistry.h"
+#include "TextureStreamer.h"
+#include "UniformRing.h"
+#include "VulkanResources.h"
+
+// NOTE(jan): Default or surface, sky and fluid, for every swap image, so that
+// each image's descriptor sets bind its own uniform ring blocks. Created for
+// the first level, and only their descriptor sets are rewritten for later
+// ones.
+static vector<vector<VulkanPipeline>> levelPipelines;
+static TextureStreamer* levelStreamer;
+static FaceTable levelFaces;
+// NOTE(jan): Faces that passed culling in the last update, see cullFaces.
+static vector<uint32_t> levelVisibleFaces;
+// NOTE(jan): One indirect draw per cluster, see Mesh::draws. updateLevel
+// zeroes the culled ones and streams them through levelDrawRing every frame.
+static vector<IndexedDraw> levelDraws;
+static UniformRing levelDrawRing;
+static vector<DrawRange> levelDrawRanges;
+static vector<Cluster> levelClusters;
+static vector<ModelRange> levelModelRanges;
+// NOTE(jan): One transform per BSP model, read by the vertex shaders through
+// the face records. Nothing moves brush models yet, so they stay identity and
+// are uploaded once.
+static vector<mat4> levelTransforms;
+static LightCompositor* levelLights;
+// NOTE(jan): Only with -surfacecache, which replaces the default pipeline.
+static SurfaceCache* levelSurfaces;
+// NOTE(jan): Registry hashes of the textures the level acquired.
+static vector<uint64_t> levelTextures;
+static vector<VulkanTextureArray> levelSkies;
+static VulkanMesh levelDefaultMesh;
+static VulkanMesh levelSkyMesh;
+static VulkanMesh levelFluidMesh;
+// NOTE(jan): Storage buffers that are written once per level, like the face
+// records and texture tables.
+static vector<VulkanBuffer> levelBuffers;
+
+// NOTE(jan): Binds the table to the pipeline at pipelineIdx of every image.
+// The locations at binding 5 are bound by the caller.
+void uploadTextureTable(Vulkan& vk, TextureTable& table, int pipelineIdx) {
+    VulkanBuffer animations;
+    uploadStorageBuffer(
+        vk,
+        table.animations.data(),
+        table.animations.size() * sizeof(TextureAnimation),
+        animations
+    );
+    levelBuffers.push_back(animations);
+
+    VulkanBuffer frames;
+    uploadStorageBuffer(
+        vk,
+        table.frames.data(),
+        table.frames.size() * sizeof(uint32_t),
+        frames
+    );
+    levelBuffers.push_back(frames);
+
+    for (auto& pipelines: levelPipelines) {
+        auto set = pipelines[pipelineIdx].descriptorSet;
+        updateStorageBuffer(vk.device, set, 3, animations);
+        updateStorageBuffer(vk.device, set, 4, frames);
+    }
+}
+
+// NOTE(jan): Frees everything the previous level created, except its
+// textures, which go back to the registry. The device must be idle.
+static void releaseLevel(Vulkan& vk) {
+    levelDrawRing.release(vk);
+    levelDraws.clear();
+    for (auto& buffer: levelBuffers) {
+        destroyBuffer(vk, buffer);
+    }
+    levelBuffers.clear();
+    for (auto& sky: levelSkies) {
+        destroyTextureArray(vk, sky);
+    }
+    levelSkies.clear();
+    destroyMesh(vk, levelDefaultMesh);
+    destroyMesh(vk, levelSkyMesh);
+    destroyMesh(vk, levelFluidMesh);
+    delete levelSurfaces;
+    levelSurfaces = nullptr;
+    delete levelLights;
+    levelLights = nullptr;
+}
+
+// NOTE(jan): Releases the previous level along with its streamer and
+// textures.
+static void releasePreviousLevel(
+    Vulkan& vk,
+    TextureStreamer* streamer,
+    vector<uint64_t>& textures
+) {
+    if (streamer) {
+        VKCHECK(vkDeviceWaitIdle(vk.device));
+        delete streamer;
+        releaseLevel(vk);
+    }
+    auto& registry = getTextureRegistry();
+    for (auto hash: textures) {
+        registry.release(hash);
+    }
+    textures.clear();
+}
+
+// NOTE(jan): An upper bound on the arrays a level can need, with a full
+// registry array for every size class and a streaming pool for every default
+// one.
+static uint32_t countLevelArrays(BSPTextureParser& textures) {
+    uint32_t count = 0;
+    for (auto packer: { textures.fluidPacker, textures.defaultPacker }) {
+        for (auto& layout: packer->arrays) {
+            auto members = (uint32_t)layout.members.size();
+            count += (members + REGISTRY_ARRAY_LAYERS - 1) /
+                REGISTRY_ARRAY_LAYERS;
+        }
+    }
+    return count + textures.defaultPacker->arrays.size();
+}
 
 void renderLevel(
     Vulkan& vk,
@@ -11,89 +140,167 @@ void renderLevel(
     const int DEFAULT = 0;
     const int SKY = 1;
     const int FLUID = 2;
-    vector<VulkanPipeline> pipelines(3);
-    initVKPipeline(vk, "default", pipelines[DEFAULT]);
-    initVKPipeline(vk, "sky", pipelines[SKY]);
-    initVKPipeline(vk, "fluid", pipelines[FLUID]);
+    uint32_t framebufferCount = vk.swap.images.size();
+    if (levelPipelines.empty()) {
+        levelPipelines.resize(framebufferCount);
+        for (auto& pipelines: levelPipelines) {
+            pipelines.resize(3);
+            initVKPipeline(
+                vk,
+                surfaceCacheEnabled ? "surface" : "default",
+                pipelines[DEFAULT]
+            );
+            initVKPipeline(vk, "sky", pipelines[SKY]);
+            initVKPipeline(vk, "fluid", pipelines[FLUID]);
+        }
+    }
 
     auto& textures = *map.textures;
-    vector<VulkanSampler> defaultSamplers;
-    vector<VulkanSampler> skySamplers;
-    vector<VulkanSampler> fluidSamplers;
-    for (auto& texture: textures.textures) {
-        auto& sampler = defaultSamplers.emplace_back();
-        uint32_t size = texture.texels.size() * sizeof(uint8_t);
-        uploadTexture(
-            vk.device,
-            vk.memories,
-            vk.queue,
-            vk.queueFamily,
-            vk.cmdPoolTransient,
-            texture.width,
-            texture.height,
-            texture.texels.data(),
-            size,
-            sampler
+    auto& registry = getTextureRegistry();
+
+    // NOTE(jan): The previous level is released only once this one has
+    // acquired its textures, so the textures they share stay resident. When
+    // the array table cannot hold both levels, it is released first and the
+    // shared textures are uploaded again.
+    auto previousStreamer = levelStreamer;
+    auto previousTextures = std::move(levelTextures);
+    levelTextures.clear();
+    if (registry.spareArrays() < countLevelArrays(textures)) {
+        releasePreviousLevel(vk, previousStreamer, previousTextures);
+        previousStreamer = nullptr;
+        registry.trim(vk);
+    }
+
+    // NOTE(jan): Fluids come first so that the streamer's pools follow every
+    // registry array this level uses.
+    auto& fluidPacker = *textures.fluidPacker;
+    vector<uint32_t> fluidLocations(textures.fluidTextures.size());
+    for (size_t arrayIdx = 0; arrayIdx < fluidPacker.arrays.size(); arrayIdx++) {
+        getJobSystem().wait(textures.fluidDecodes[arrayIdx]);
+        registry.acquireClass(
+            vk,
+            textures.fluidTextures,
+            fluidPacker.arrays[arrayIdx],
+            0,
+            fluidLocations
         );
     }
-    updateCombinedImageSampler(
-        vk.device,
-        pipelines[DEFAULT].descriptorSet,
-        1,
-        defaultSamplers.data(),
-        defaultSamplers.size()
+    levelStreamer = new TextureStreamer(
+        vk,
+        textures.textures,
+        *textures.defaultPacker,
+        textures.defaultDecodes,
+        textures.defaultTable
     );
+    for (auto& texture: textures.fluidTextures) {
+        levelTextures.push_back(texture.hash);
+    }
+    for (auto& texture: textures.textures) {
+        levelTextures.push_back(texture.hash);
+    }
+
+    releasePreviousLevel(vk, previousStreamer, previousTextures);
+
+    if (!surfaceCacheEnabled) {
+        for (uint32_t image = 0; image < framebufferCount; image++) {
+            auto set = levelPipelines[image][DEFAULT].descriptorSet;
+            updateCombinedImageSamplerArrays(
+                vk.device,
+                set,
+                1,
+                levelStreamer->arrays
+            );
+            levelStreamer->locations.updateDescriptor(vk.device, set, 5, image);
+        }
+        uploadTextureTable(vk, textures.defaultTable, DEFAULT);
+    }
     if (textures.skyTextures.size()) {
+        getJobSystem().wait(textures.skyDecodes);
         for (auto& texture: textures.skyTextures) {
-            auto& sampler = skySamplers.emplace_back();
-            uint32_t size = texture.texels.size() * sizeof(uint8_t);
-            uploadTexture(
-                vk.device,
-                vk.memories,
-                vk.queue,
-                vk.queueFamily,
-                vk.cmdPoolTransient,
+            auto& sky = levelSkies.emplace_back();
+            createTextureArray(
+                vk,
+                texture.format,
                 texture.width,
                 texture.height,
+                1,
+                1,
+                sky
+            );
+            uploadTextureArrayLayers(
+                vk,
+                sky,
+                0,
+                1,
                 texture.texels.data(),
-                size,
-                sampler
+                texture.texels.size()
+            );
+        }
+        for (auto& pipelines: levelPipelines) {
+            updateCombinedImageSamplerArrays(
+                vk.device,
+                pipelines[SKY].descriptorSet,
+                1,
+                levelSkies
             );
         }
-        updateCombinedImageSampler(
+    }
+    for (auto& pipelines: levelPipelines) {
+        updateCombinedImageSamplerArrays(
             vk.device,
-            pipelines[SKY].descriptorSet,
+            pipelines[FLUID].descriptorSet,
             1,
-            skySamplers.data(),
-            skySamplers.size()
+            levelStreamer->arrays
         );
     }
-    for (auto& texture: textures.fluidTextures) {
-        auto& sampler = fluidSamplers.emplace_back();
-        uint32_t size = texture.texels.size() * sizeof(uint8_t);
-        uploadTexture(
+    VulkanBuffer fluidLocationBuffer;
+    uploadStorageBuffer(
+        vk,
+        fluidLocations.data(),
+        fluidLocations.size() * sizeof(uint32_t),
+        fluidLocationBuffer
+    );
+    uploadTextureTable(vk, textures.fluidTable, FLUID);
+    for (auto& pipelines: levelPipelines) {
+        updateStorageBuffer(
             vk.device,
-            vk.memories,
-            vk.queue,
-            vk.queueFamily,
-            vk.cmdPoolTransient,
-            texture.width,
-            texture.height,
-            texture.texels.data(),
-            size,
-            sampler
+            pipelines[FLUID].descriptorSet,
+            5,
+            fluidLocationBuffer
         );
     }
-    updateCombinedImageSampler(
-        vk.device,
-        pipelines[FLUID].descriptorSet,
-        1,
-        fluidSamplers.data(),
-        fluidSamplers.size()
-    );
+    levelBuffers.push_back(fluidLocationBuffer);
 
     Mesh mesh(map);
-    VulkanMesh defaultMesh;
+    levelFaces = mesh.faceTable;
+    levelDrawRanges = mesh.drawRanges;
+    levelClusters = mesh.clusters;
+    levelModelRanges = mesh.modelRanges;
+    levelDraws = mesh.draws;
+    // NOTE(jan): The ring cannot be empty. An extra draw is never recorded.
+    if (levelDraws.empty()) {
+        levelDraws.emplace_back();
+    }
+    levelDrawRing.init(
+        vk,
+        levelDraws.size() * sizeof(IndexedDraw),
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+    );
+
+    levelTransforms.assign(
+        std::max(map.models.size(), (size_t)1),
+        mat4(1.f)
+    );
+    VulkanBuffer transformBuffer;
+    uploadStorageBuffer(
+        vk,
+        levelTransforms.data(),
+        levelTransforms.size() * sizeof(mat4),
+        transformBuffer
+    );
+    levelBuffers.push_back(transformBuffer);
+    auto& defaultMesh = levelDefaultMesh;
+    defaultMesh = {};
     uploadMesh(
         vk.device,
         vk.memories,
@@ -103,7 +310,14 @@ void renderLevel(
         defaultMesh
     );
     defaultMesh.vCount = mesh.vertices.size();
-    VulkanMesh skyMesh;
+    auto defaultIndexType = uploadIndices(
+        vk,
+        mesh.indices,
+        defaultMesh.vCount,
+        defaultMesh
+    );
+    auto& skyMesh = levelSkyMesh;
+    skyMesh = {};
     if (mesh.skyVertices.size()) {
         uploadMesh(
             vk.device,
@@ -115,7 +329,14 @@ void renderLevel(
         );
         skyMesh.vCount = mesh.skyVertices.size();
     }
-    VulkanMesh fluidMesh;
+    auto skyIndexType = uploadIndices(
+        vk,
+        mesh.skyIndices,
+        mesh.skyVertices.size(),
+        skyMesh
+    );
+    auto& fluidMesh = levelFluidMesh;
+    fluidMesh = {};
     uploadMesh(
         vk.device,
         vk.memories,
@@ -125,39 +346,87 @@ void renderLevel(
         fluidMesh
     );
     fluidMesh.vCount = mesh.fluidVertices.size();
-
-    VulkanBuffer lightMapBuffer;
-    uploadTexelBuffer(
-        vk.device,
-        vk.memories,
-        vk.queueFamily,
-        mesh.lightMap.data(),
-        mesh.lightMap.size() * 4,
-        lightMapBuffer
+    auto fluidIndexType = uploadIndices(
+        vk,
+        mesh.fluidIndices,
+        fluidMesh.vCount,
+        fluidMesh
     );
-    updateUniformTexelBuffer(
-        vk.device,
-        pipelines[DEFAULT].descriptorSet,
-        2,
-        lightMapBuffer.view
+
+    VulkanBuffer faceBuffer;
+    uploadStorageBuffer(
+        vk,
+        mesh.faceRecords.data(),
+        mesh.faceRecords.size() * sizeof(FaceRecord),
+        faceBuffer
     );
+    levelBuffers.push_back(faceBuffer);
+    levelLights = new LightCompositor(vk, map, mesh);
+    if (surfaceCacheEnabled) {
+        levelSurfaces = new SurfaceCache(vk, map, mesh, *levelLights);
+    }
 
-    for (auto& pipeline: pipelines) {
-        updateUniformBuffer(
-            vk.device,
-            pipeline.descriptorSet,
-            0,
-            vk.uniforms.handle
-        );
+    for (uint32_t image = 0; image < framebufferCount; image++) {
+        auto& pipelines = levelPipelines[image];
+        for (auto& pipeline: pipelines) {
+            getUniformRing().updateDescriptor(
+                vk.device,
+                pipeline.descriptorSet,
+                0,
+                image
+            );
+            updateStorageBuffer(
+                vk.device,
+                pipeline.descriptorSet,
+                6,
+                faceBuffer
+            );
+            updateStorageBuffer(
+                vk.device,
+                pipeline.descriptorSet,
+                7,
+                transformBuffer
+            );
+        }
+        if (surfaceCacheEnabled) {
+            updateCombinedImageSamplerArrays(
+                vk.device,
+                pipelines[DEFAULT].descriptorSet,
+                1,
+                levelSurfaces->arrays
+            );
+            levelSurfaces->placements.updateDescriptor(
+                vk.device,
+                pipelines[DEFAULT].descriptorSet,
+                8,
+                image
+            );
+        } else {
+            updateCombinedImageSamplerArrays(
+                vk.device,
+                pipelines[DEFAULT].descriptorSet,
+                2,
+                levelLights->atlas
+            );
+        }
     }
 
-    uint32_t framebufferCount = vk.swap.images.size();
     cmds.resize(framebufferCount);
     createCommandBuffers(vk.device, vk.cmdPool, framebufferCount, cmds.data());
-    for (size_t swapIdx = 0; swapIdx < framebufferCount; swapIdx++) {
+    for (uint32_t swapIdx = 0; swapIdx < framebufferCount; swapIdx++) {
         auto& cmd = cmds[swapIdx];
+        auto& pipelines = levelPipelines[swapIdx];
         beginFrameCommandBuffer(cmd);
 
+        // NOTE(jan): The level's command buffers come first in every frame,
+        // so they also copy the global uniforms for the models and text.
+        getUniformRing().recordCopy(cmd, swapIdx);
+        levelDrawRing.recordCopy(cmd, swapIdx);
+        levelStreamer->locations.recordCopy(cmd, swapIdx);
+        if (levelSurfaces) {
+            levelSurfaces->placements.recordCopy(cmd, swapIdx);
+        }
+
         VkClearValue colorClear;
         colorClear.color = {1.f, 1.f, 1.f, 1.f};
         VkClearValue depthClear;
@@ -198,13 +467,28 @@ void renderLevel(
             &defaultMesh.vBuff.handle,
             offsets
         );
-        vkCmdDraw(
+        vkCmdBindIndexBuffer(
             cmd,
-            defaultMesh.vCount, 1,
-            0, 0
+            defaultMesh.iBuff.handle,
+            0,
+            defaultIndexType
         );
+        // NOTE(jan): One draw per call, since multiDrawIndirect is not
+        // enabled on the device. Every draw is a cluster of faces that sample
+        // a single texture, and culled clusters cost an empty draw.
+        for (uint32_t drawIdx = 0; drawIdx < mesh.draws.size(); drawIdx++) {
+            auto drawOffset = levelDrawRing.offset(swapIdx) +
+                drawIdx * sizeof(IndexedDraw);
+            vkCmdDrawIndexedIndirect(
+                cmd,
+                levelDrawRing.blocks.handle,
+                drawOffset,
+                1,
+                sizeof(IndexedDraw)
+            );
+        }
 
-        if (mesh.skyVertices.size()) {
+        if (skyMesh.idxCount) {
             vkCmdBindPipeline(
                 cmd,
                 VK_PIPELINE_BIND_POINT_GRAPHICS,
@@ -227,43 +511,135 @@ void renderLevel(
                 &skyMesh.vBuff.handle,
                 offsets
             );
-            vkCmdDraw(
+            vkCmdBindIndexBuffer(
                 cmd,
-                skyMesh.vCount, 1,
-                0, 0
+                skyMesh.iBuff.handle,
+                0,
+                skyIndexType
+            );
+            vkCmdDrawIndexed(
+                cmd,
+                skyMesh.idxCount, 1,
+                0, 0, 0
             );
         }
 
-        vkCmdBindPipeline(
-            cmd,
-            VK_PIPELINE_BIND_POINT_GRAPHICS,
-            pipelines[FLUID].handle
-        );
-        vkCmdBindDescriptorSets(
-            cmd,
-            VK_PIPELINE_BIND_POINT_GRAPHICS,
-            pipelines[FLUID].layout,
-            0,
-            1,
-            &pipelines[FLUID].descriptorSet,
-            0,
-            nullptr
-        );
+        if (fluidMesh.idxCount) {
+            vkCmdBindPipeline(
+                cmd,
+                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                pipelines[FLUID].handle
+            );
+            vkCmdBindDescriptorSets(
+                cmd,
+                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                pipelines[FLUID].layout,
+                0,
+                1,
+                &pipelines[FLUID].descriptorSet,
+                0,
+                nullptr
+            );
 
-        vkCmdBindVertexBuffers(
-            cmd,
-            0, 1,
-            &fluidMesh.vBuff.handle,
-            offsets
-        );
-        vkCmdDraw(
-            cmd,
-            fluidMesh.vCount, 1,
-            0, 0
-        );
+            vkCmdBindVertexBuffers(
+                cmd,
+                0, 1,
+                &fluidMesh.vBuff.handle,
+                offsets
+            );
+            vkCmdBindIndexBuffer(
+                cmd,
+                fluidMesh.iBuff.handle,
+                0,
+                fluidIndexType
+            );
+            // NOTE(jan): One draw per texture, so that fluid.frag indexes the
+            // texture arrays with a dynamically uniform value.
+            for (auto& draw: mesh.fluidDraws) {
+                vkCmdDrawIndexed(
+                    cmd,
+                    draw.indexCount, 1,
+                    draw.firstIndex, 0, 0
+                );
+            }
+        }
 
         vkCmdEndRenderPass(cmd);
 
         VKCHECK(vkEndCommandBuffer(cmd));
     }
 }
+
+void updateLevel(
+    Vulkan& vk,
+    Camera& camera,
+    const float* lightStyles,
+    float elapsedS
+) {
+    levelLights->update(lightStyles);
+
+    auto viewProjection = camera.get();
+
+    levelVisibleFaces.clear();
+    for (uint32_t modelIdx = 0; modelIdx < levelModelRanges.size(); modelIdx++) {
+        auto& model = levelModelRanges[modelIdx];
+        // NOTE(jan): Culling happens in model space, so only the frustum and
+        // the eye are transformed rather than every box, sphere and cone.
+        // Distances stay the same, since brush models only move and turn.
+        auto& transform = levelTransforms[modelIdx];
+        Frustum frustum(viewProjection * transform);
+        vec3 eye = camera.eye;
+        if (modelIdx != 0) {
+            eye = glm::inverse(transform) * vec4(camera.eye, 1.f);
+        }
+        bool visible = frustum.intersects(model.min, model.max);
+
+        for (uint32_t i = 0; i < model.drawCount; i++) {
+            auto& range = levelDrawRanges[model.firstDraw + i];
+            bool rangeDrawn = visible &&
+                frustum.intersects(range.min, range.max);
+
+            for (uint32_t j = 0; j < range.clusterCount; j++) {
+                auto clusterIdx = range.firstCluster + j;
+                auto& cluster = levelClusters[clusterIdx];
+                bool drawn = rangeDrawn &&
+                    !coneFacesAway(cluster.sphere, cluster.cone, eye) &&
+                    frustum.intersects(cluster.sphere) &&
+                    frustum.intersects(cluster.min, cluster.max);
+                levelDraws[clusterIdx].instanceCount = drawn ? 1 : 0;
+                if (!drawn) {
+                    continue;
+                }
+
+                auto firstVisible = levelVisibleFaces.size();
+                cullFaces(
+                    levelFaces,
+                    cluster.firstFace,
+                    cluster.faceCount,
+                    frustum,
+                    eye,
+                    levelVisibleFaces
+                );
+                for (auto k = firstVisible; k < levelVisibleFaces.size(); k++) {
+                    auto face = levelVisibleFaces[k];
+                    auto distance = distanceToBox(
+                        eye,
+                        levelFaces.min(face),
+                        levelFaces.max(face)
+                    );
+                    auto record = levelFaces.records[face];
+                    if (levelSurfaces) {
+                        levelSurfaces->request(record, distance);
+                    } else if (distance < STREAMING_DISTANCE) {
+                        levelStreamer->request(levelFaces.texSlots[face]);
+                    }
+                }
+            }
+        }
+    }
+    levelDrawRing.push(levelDraws.data());
+    levelStreamer->update();
+    if (levelSurfaces) {
+        levelSurfaces->update(elapsedS);
+    }
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "BSPParser.h"
+#include "Camera.h"
 #include "Vulkan.h"
 
 void renderLevel(
@@ -8,3 +9,13 @@ void renderLevel(
     BSPParser& map,
     vector<VkCommandBuffer>& cmds
 );
+
+// NOTE(jan): Composites light maps whose styles changed, culls level draws,
+// and streams in the textures or builds the surfaces of visible faces. Takes
+// one value per light style, see LightCompositor.h.
+void updateLevel(
+    Vulkan& vk,
+    Camera& camera,
+    const float* lightStyles,
+    float elapsedS
+);
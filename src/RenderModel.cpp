@@ -1,13 +1,20 @@
 #pragma warning(disable: 4018)
 #pragma warning(disable: 4267)
 
+#include <algorithm>
 #include <cmath>
 
 #include "RenderModel.h"
+#include "UniformRing.h"
+#include "VulkanResources.h"
 
 #include "FileSystem.h"
+#include "Frustum.h"
+#include "JobSystem.h"
 #include "Palette.h"
+#include "VertexCache.h"
 
+#include "glm/geometric.hpp"
 #include "glm/vec2.hpp"
 #include "glm/vec3.hpp"
 
@@ -70,18 +77,55 @@ struct ModelVertex {
     vec2 texCoord;
 };
 
-struct PushConstant {
+// NOTE(jan): Keep in sync with ModelInstance in alias_model.vert.
+struct ModelInstance {
     vec3 origin;
     float angle;
 };
 
+// NOTE(jan): Where the model's visible instances start. Pushed once per model
+// rather than using firstInstance, which indirect draws may not support.
+struct PushConstant {
+    uint32_t firstInstance;
+};
+
+const uint32_t MODEL_VERTEX_NONE = 0xFFFFFFFF;
+
 struct AliasModel {
-    vector<PushConstant> pushConstants;
+    // NOTE(jan): Every entity using the model. Visible ones are copied to the
+    // model's range of the streamed instances each frame.
+    vector<ModelInstance> instances;
+    uint32_t firstInstance;
+    // NOTE(jan): Bounds every frame, around the entity's origin, so turning
+    // does not change it.
+    float radius;
     FrameGroup group;
-    vector<VulkanMesh> frames;
-    VulkanPipeline pipeline;
+    // NOTE(jan): The vertices of every frame after each other, with one index
+    // buffer that every frame shares.
+    VulkanMesh mesh;
+    VkIndexType indexType;
+    uint32_t vertexCount;
+    // NOTE(jan): One per swap image.
+    vector<VulkanPipeline> pipelines;
+    Texture skin;
+    // NOTE(jan): A single array with the skin in its only layer.
+    vector<VulkanTextureArray> skinArrays;
 };
 vector<AliasModel> models;
+// NOTE(jan): One per swap image for every entry in models, which every level
+// fills in the same order. Created for the first level, and only their
+// descriptor sets are rewritten for later ones.
+static vector<vector<VulkanPipeline>> modelPipelines;
+/* NOTE(jan): The instances of every model, followed by one instanced indirect
+   draw per model. The draw's vertex offset picks the animation frame and its
+   instance count is what survived culling. updateModels writes all of it and
+   streams it through modelRing every frame, so the command buffers are only
+   recorded once per level. */
+static vector<uint8_t> modelBlock;
+static ModelInstance* modelInstances;
+static VkDrawIndexedIndirectCommand* modelDraws;
+static VkDeviceSize modelDrawOffset;
+static UniformRing modelRing;
 
 void readFrame(FILE* file, int32_t numverts, Frame& frame) {
     readStruct(file, frame.min);
@@ -128,26 +172,35 @@ void initModel(
     int spawnFlagFilter,
     AliasModel& model
 ) {
-    initVKPipelineCCW(vk, "alias_model", model.pipeline);
-    updateUniformBuffer(
-        vk.device,
-        model.pipeline.descriptorSet,
-        0,
-        vk.uniforms.handle
-    );
+    auto modelIdx = (size_t)(&model - models.data());
+    if (modelIdx == modelPipelines.size()) {
+        auto& pipelines = modelPipelines.emplace_back();
+        pipelines.resize(vk.swap.images.size());
+        for (auto& pipeline: pipelines) {
+            initVKPipelineCCW(vk, "alias_model", pipeline);
+        }
+    }
+    model.pipelines = modelPipelines[modelIdx];
+    for (uint32_t image = 0; image < model.pipelines.size(); image++) {
+        getUniformRing().updateDescriptor(
+            vk.device,
+            model.pipelines[image].descriptorSet,
+            0,
+            image
+        );
+    }
 
     for (auto& entity: entities) {
         auto name = entity.className;
         if (strcmp(name, entityName) == 0) {
             if ((!spawnFlagFilter) || (entity.spawnflags & spawnFlagFilter)) {
-                auto& pushConstant = model.pushConstants.emplace_back();
-                pushConstant.angle = (float)entity.angle;
-                pushConstant.origin = entity.origin;
+                auto& instance = model.instances.emplace_back();
+                instance.angle = (float)entity.angle;
+                instance.origin = entity.origin;
             }
         }
     }
 
-    auto palette = pak.loadPalette();
     auto file = pak.file;
     auto entry = pak.findEntry(mdlName);
     MDLHeader header;
@@ -161,44 +214,15 @@ void initModel(
         FATAL("group skins not supported");
     }
 
+    auto& skin = model.skin;
+    strncpy_s(skin.name, mdlName, sizeof(skin.name) - 1);
+    skin.width = header.skinwidth;
+    skin.height = header.skinheight;
+    skin.mipLevels = 1;
     uint32_t skinIdxsSize = header.skinheight * header.skinwidth;
-    vector<uint8_t> skinIdxs(skinIdxsSize);
-    fread(skinIdxs.data(), skinIdxsSize, 1, file);
-
-    uint32_t skinColorsSize = skinIdxsSize * 4;
-    vector<uint8_t> skinColors(skinColorsSize);
-
-    for (uint32_t i = 0; i < skinIdxsSize; i++) {
-        auto colorIdx = skinIdxs[i];
-        auto paletteColor = palette->colors[colorIdx];
-        skinColors[i*4] = paletteColor.r;
-        skinColors[i*4+1] = paletteColor.g;
-        skinColors[i*4+2] = paletteColor.b;
-        skinColors[i*4+3] = 255;
-    }
-    delete palette;
-
-    VulkanSampler sampler = {};
-    uploadTexture(
-        vk.device,
-        vk.memories,
-        vk.queue,
-        vk.queueFamily,
-        vk.cmdPoolTransient,
-        header.skinwidth,
-        header.skinheight,
-        skinColors.data(),
-        skinColorsSize,
-        sampler
-    );
-
-    updateCombinedImageSampler(
-        vk.device,
-        model.pipeline.descriptorSet,
-        1,
-        &sampler,
-        1
-    );
+    skin.colorIndices.resize(skinIdxsSize);
+    fread(skin.colorIndices.data(), skinIdxsSize, 1, file);
+    skin.format = chooseTextureFormat(skin);
 
     vector<TexCoord> texCoords(header.numverts);
     fread(texCoords.data(), sizeof(TexCoord), header.numverts, file);
@@ -214,43 +238,156 @@ void initModel(
         readFrameGroup(file, header.numverts, model.group);
     }
 
-    for (auto& frame: model.group.frames) {
-        vector<ModelVertex> vertices;
-
-        for (auto& triangle: triangles) {
-            for (int i = 0; i < 3; i ++) {
-                auto vertIdx = triangle.vertices[i];
-                auto& vertex = vertices.emplace_back();
-
-                auto& packedVertex = frame.vertices[vertIdx];
-                vertex.position.x = packedVertex.packedPosition[0]
-                    * header.scale.x + header.origin.x;
-                vertex.position.y = -packedVertex.packedPosition[2]
-                    * header.scale.z - header.origin.z;
-                vertex.position.z = packedVertex.packedPosition[1]
-                    * header.scale.y + header.origin.y;
-                
-                auto& texCoord = texCoords[vertIdx];
-                vertex.texCoord.s = (float)texCoord.s / header.skinwidth;
-                vertex.texCoord.t = (float)texCoord.t / header.skinheight;
-
-                if ((!triangle.facesfront) && texCoord.onseam) {
-                    vertex.texCoord.s += .5f;
-                }
+    // NOTE(jan): Seam vertices are used with two texture coordinates, one for
+    // the front and one for the back of the skin, so each MDL vertex turns
+    // into one or two mesh vertices, keyed by its index times two plus one
+    // for the back.
+    vector<uint32_t> indices;
+    indices.reserve(header.numtris * 3);
+    vector<uint32_t> keyVertices(header.numverts * 2, MODEL_VERTEX_NONE);
+    vector<uint32_t> vertexKeys;
+    for (auto& triangle: triangles) {
+        for (int i = 0; i < 3; i++) {
+            auto vertIdx = triangle.vertices[i];
+            bool back = (!triangle.facesfront) && texCoords[vertIdx].onseam;
+            auto key = vertIdx * 2 + (back ? 1 : 0);
+            if (keyVertices[key] == MODEL_VERTEX_NONE) {
+                keyVertices[key] = vertexKeys.size();
+                vertexKeys.push_back(key);
+            }
+            indices.push_back(keyVertices[key]);
+        }
+    }
+
+    auto unpackVertices = [&](Frame& frame, vector<ModelVertex>& vertices) {
+        vertices.resize(vertexKeys.size());
+        for (uint32_t i = 0; i < vertexKeys.size(); i++) {
+            auto vertIdx = vertexKeys[i] / 2;
+            auto& vertex = vertices[i];
+
+            auto& packedVertex = frame.vertices[vertIdx];
+            vertex.position.x = packedVertex.packedPosition[0]
+                * header.scale.x + header.origin.x;
+            vertex.position.y = -packedVertex.packedPosition[2]
+                * header.scale.z - header.origin.z;
+            vertex.position.z = packedVertex.packedPosition[1]
+                * header.scale.y + header.origin.y;
+
+            auto& texCoord = texCoords[vertIdx];
+            vertex.texCoord.s = (float)texCoord.s / header.skinwidth;
+            vertex.texCoord.t = (float)texCoord.t / header.skinheight;
+            if (vertexKeys[i] & 1) {
+                vertex.texCoord.s += .5f;
             }
         }
-        
-        auto& mesh = model.frames.emplace_back();
-        uploadMesh(
+    };
+
+    // NOTE(jan): Overdraw is judged on the first frame, since the poses of a
+    // model's frames are close enough to share one triangle order.
+    uint32_t vertexCount = vertexKeys.size();
+    auto before = measureACMR(indices.data(), indices.size(), vertexCount);
+    optimizeVertexCache(indices.data(), indices.size(), vertexCount);
+    vector<ModelVertex> vertices;
+    unpackVertices(model.group.frames[0], vertices);
+    optimizeOverdraw(
+        indices.data(),
+        indices.size(),
+        vertices.data(),
+        sizeof(ModelVertex),
+        vertexCount
+    );
+    auto after = measureACMR(indices.data(), indices.size(), vertexCount);
+    INFO(
+        "%s ACMR %.3f before and %.3f after vertex cache optimisation",
+        mdlName,
+        before,
+        after
+    );
+
+    // NOTE(jan): Vertices are renumbered in the order the triangles first use
+    // them, so fetching them walks forwards through memory.
+    vector<uint32_t> remap(vertexCount, MODEL_VERTEX_NONE);
+    vector<uint32_t> orderedKeys;
+    orderedKeys.reserve(vertexCount);
+    for (auto& index: indices) {
+        if (remap[index] == MODEL_VERTEX_NONE) {
+            remap[index] = orderedKeys.size();
+            orderedKeys.push_back(vertexKeys[index]);
+        }
+        index = remap[index];
+    }
+    vertexKeys = orderedKeys;
+    // NOTE(jan): Indices are relative to the start of a frame, so they stay
+    // narrow however many frames there are.
+    model.indexType = uploadIndices(
+        vk,
+        indices,
+        vertexCount,
+        model.mesh
+    );
+    model.vertexCount = vertexCount;
+
+    vector<ModelVertex> frameVertices;
+    frameVertices.reserve(vertexCount * model.group.frames.size());
+    for (auto& frame: model.group.frames) {
+        unpackVertices(frame, vertices);
+        frameVertices.insert(
+            frameVertices.end(),
+            vertices.begin(),
+            vertices.end()
+        );
+    }
+    model.radius = 0.f;
+    for (auto& vertex: frameVertices) {
+        model.radius = std::max(model.radius, glm::length(vertex.position));
+    }
+    uploadMesh(
+        vk.device,
+        vk.memories,
+        vk.queueFamily,
+        frameVertices.data(),
+        frameVertices.size() * sizeof(ModelVertex),
+        model.mesh
+    );
+    model.mesh.vCount = frameVertices.size();
+}
+
+void uploadSkin(
+    Vulkan& vk,
+    AliasModel& model
+) {
+    auto& skin = model.skin;
+    auto& arrays = model.skinArrays;
+    arrays.resize(1);
+    createTextureArray(
+        vk,
+        skin.format,
+        skin.width,
+        skin.height,
+        skin.mipLevels,
+        1,
+        arrays[0]
+    );
+    uploadTextureArrayLayers(
+        vk,
+        arrays[0],
+        0,
+        1,
+        skin.texels.data(),
+        skin.texels.size()
+    );
+
+    for (auto& pipeline: model.pipelines) {
+        updateCombinedImageSamplerArrays(
             vk.device,
-            vk.memories,
-            vk.queueFamily,
-            vertices.data(),
-            vertices.size() * sizeof(ModelVertex),
-            mesh
+            pipeline.descriptorSet,
+            1,
+            arrays
         );
-        mesh.vCount = vertices.size();
     }
+
+    skin.texels.clear();
+    skin.texels.shrink_to_fit();
 }
 
 void initModels(
@@ -440,18 +577,119 @@ void initModels(
             model
         );
     }
+
+    // NOTE(jan): Skins are decoded in parallel once the models vector stops
+    // growing, so the jobs can hold on to references into it.
+    auto& jobs = getJobSystem();
+    JobCounter skinDecodes;
+    for (auto& model: models) {
+        jobs.submit(skinDecodes, [&pak, &model]() {
+            decodeTexture(*pak.palette, model.skin);
+        });
+    }
+    jobs.wait(skinDecodes);
+    for (auto& model: models) {
+        uploadSkin(vk, model);
+    }
+
+    uint32_t instanceCount = 0;
+    for (auto& model: models) {
+        model.firstInstance = instanceCount;
+        instanceCount += model.instances.size();
+    }
+    modelDrawOffset = instanceCount * sizeof(ModelInstance);
+    modelBlock.assign(
+        modelDrawOffset + models.size() * sizeof(VkDrawIndexedIndirectCommand),
+        0
+    );
+    modelInstances = (ModelInstance*)modelBlock.data();
+    modelDraws = (VkDrawIndexedIndirectCommand*)(
+        modelBlock.data() + modelDrawOffset
+    );
+    for (uint32_t modelIdx = 0; modelIdx < models.size(); modelIdx++) {
+        auto& draw = modelDraws[modelIdx];
+        draw.indexCount = models[modelIdx].mesh.idxCount;
+        draw.instanceCount = 0;
+        draw.firstIndex = 0;
+        draw.vertexOffset = 0;
+        draw.firstInstance = 0;
+    }
+
+    modelRing.init(
+        vk,
+        modelBlock.size(),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+    );
+    for (auto& model: models) {
+        for (uint32_t image = 0; image < model.pipelines.size(); image++) {
+            modelRing.updateDescriptor(
+                vk.device,
+                model.pipelines[image].descriptorSet,
+                2,
+                image
+            );
+        }
+    }
+}
+
+void releaseModels(Vulkan& vk) {
+    if (modelDraws) {
+        modelRing.release(vk);
+        modelBlock.clear();
+        modelInstances = nullptr;
+        modelDraws = nullptr;
+    }
+    for (auto& model: models) {
+        destroyMesh(vk, model.mesh);
+        for (auto& array: model.skinArrays) {
+            destroyTextureArray(vk, array);
+        }
+    }
+    models.clear();
+}
+
+void updateModels(Vulkan& vk, Camera& camera, float elapsedS) {
+    Frustum frustum(camera.get());
+    for (uint32_t modelIdx = 0; modelIdx < models.size(); modelIdx++) {
+        auto& model = models[modelIdx];
+        auto& draw = modelDraws[modelIdx];
+
+        draw.instanceCount = 0;
+        for (auto& instance: model.instances) {
+            vec4 sphere(instance.origin, model.radius);
+            if (frustum.intersects(sphere)) {
+                auto idx = model.firstInstance + draw.instanceCount++;
+                modelInstances[idx] = instance;
+            }
+        }
+
+        auto& frameGroup = model.group;
+        float maxTime = frameGroup.times[frameGroup.times.size()-1];
+        float animationTime = std::fmod(elapsedS, maxTime);
+        uint32_t frameIdx = 0;
+        for (frameIdx = 0; frameIdx < frameGroup.times.size(); frameIdx++) {
+            float frameTime = frameGroup.times[frameIdx];
+            if (animationTime < frameTime) {
+                break;
+            }
+        }
+        frameIdx = std::min(frameIdx, (uint32_t)frameGroup.times.size() - 1);
+        draw.vertexOffset = frameIdx * model.vertexCount;
+    }
+
+    modelRing.push(modelBlock.data());
 }
 
 void recordModelCommandBuffers(
     Vulkan& vk,
-    float epoch,
     vector<VkCommandBuffer>& cmds
 ) {
     auto framebufferCount = vk.swap.images.size();
     cmds.resize(framebufferCount);
     createCommandBuffers(
         vk.device,
-        vk.cmdPoolTransient,
+        vk.cmdPool,
         framebufferCount,
         cmds.data()
     );
@@ -460,6 +698,7 @@ void recordModelCommandBuffers(
         auto& fb = vk.swap.framebuffers[idx];
 
         beginFrameCommandBuffer(cmd);
+        modelRing.recordCopy(cmd, idx);
 
         VkRenderPassBeginInfo beginInfo = {};
         beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -472,40 +711,44 @@ void recordModelCommandBuffers(
         vkCmdBeginRenderPass(cmd, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
         VkDeviceSize offsets[] = {0};
 
-        for (auto& model: models) {
-            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, model.pipeline.handle);
+        for (uint32_t modelIdx = 0; modelIdx < models.size(); modelIdx++) {
+            auto& model = models[modelIdx];
+            auto& pipeline = model.pipelines[idx];
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.handle);
             vkCmdBindDescriptorSets(
                 cmd,
                 VK_PIPELINE_BIND_POINT_GRAPHICS,
-                model.pipeline.layout,
+                pipeline.layout,
                 0, 1,
-                &model.pipeline.descriptorSet,
+                &pipeline.descriptorSet,
                 0, nullptr
             );
 
-            auto& frameGroup = model.group;
-            float maxTime = frameGroup.times[frameGroup.times.size()-1];
-            float animationTime = std::fmod(epoch, maxTime);
-            uint32_t frameIdx = 0;
-            for (frameIdx = 0; frameIdx < frameGroup.times.size(); frameIdx++) {
-                float frameTime = frameGroup.times[frameIdx];
-                if (animationTime < frameTime) {
-                    break;
-                }
-            }
-            auto& mesh = model.frames[frameIdx];
-            vkCmdBindVertexBuffers(cmd, 0, 1, &mesh.vBuff.handle, offsets);
-            for (auto& pushConstant: model.pushConstants) {
-                vkCmdPushConstants(
-                    cmd,
-                    model.pipeline.layout,
-                    VK_SHADER_STAGE_VERTEX_BIT,
-                    0,
-                    sizeof(pushConstant),
-                    &pushConstant
-                );
-                vkCmdDraw(cmd, mesh.vCount, 1, 0, 0);
-            }
+            vkCmdBindVertexBuffers(cmd, 0, 1, &model.mesh.vBuff.handle, offsets);
+            vkCmdBindIndexBuffer(
+                cmd,
+                model.mesh.iBuff.handle,
+                0,
+                model.indexType
+            );
+            PushConstant pushConstant = { model.firstInstance };
+            vkCmdPushConstants(
+                cmd,
+                pipeline.layout,
+                VK_SHADER_STAGE_VERTEX_BIT,
+                0,
+                sizeof(pushConstant),
+                &pushConstant
+            );
+            // NOTE(jan): Every visible entity of the model in one draw.
+            vkCmdDrawIndexedIndirect(
+                cmd,
+                modelRing.blocks.handle,
+                modelRing.offset(idx) + modelDrawOffset +
+                    modelIdx * sizeof(VkDrawIndexedIndirectCommand),
+                1,
+                sizeof(VkDrawIndexedIndirectCommand)
+            );
         }
 
         vkCmdEndRenderPass(cmd);
@@ -2,6 +2,7 @@
 
 #include <vector>
 
+#include "Camera.h"
 #include "PAKParser.h"
 #include "Vulkan.h"
 
@@ -13,8 +14,18 @@ void initModels(
     vector<Entity>& entities
 );
 
+// NOTE(jan): Frees the models of the current level, except their pipelines,
+// which the next level reuses. The device must be idle.
+void releaseModels(Vulkan& vk);
+
+// NOTE(jan): Picks the animation frame of every model and culls its
+// instances. Call once per frame, before presenting it.
+void updateModels(Vulkan& vk, Camera& camera, float elapsedS);
+
+// NOTE(jan): Records once per level, from the persistent command pool, since
+// animation only changes the indirect draws. Free them before the models are
+// released.
 void recordModelCommandBuffers(
     Vulkan& vk,
-    float epoch,
     vector<VkCommandBuffer>& cmds
 );
@@ -3,96 +3,142 @@
 #include "stb/stb_easy_font.h"
 
 #include "RenderText.h"
+#include "UniformRing.h"
 
 const float SIZE_X = 0;
 const float SIZE_Y = 0;
 const uint32_t VERTICES_PER_QUAD = 4;
+const uint32_t INDICES_PER_QUAD = 6;
+const uint32_t TEXT_MAX_GLYPHS = 1024;
+
+// NOTE(jan): What stb_easy_font writes for every vertex of a quad.
+struct EasyFontVertex {
+    float x;
+    float y;
+    float z;
+    uint8_t colour[4];
+};
+
+// NOTE(jan): Keep in sync with Glyph in text.vert.
+struct TextGlyph {
+    float rect[4];
+    float colour[4];
+};
+
+/* NOTE(jan): Streamed whole every frame. The draw comes first and is padded
+   to 32 bytes, which is where text.vert expects the glyphs. */
+struct TextBlock {
+    VkDrawIndexedIndirectCommand draw;
+    uint32_t padding[3];
+    TextGlyph glyphs[TEXT_MAX_GLYPHS];
+};
+
+// NOTE(jan): One per swap image.
+static vector<VulkanPipeline> textPipelines;
+static VulkanMesh textQuad;
+static UniformRing textRing;
+static TextBlock textBlock;
+
+// NOTE(jan): One unit quad that every glyph stretches over its own rectangle.
+static void createTextQuad(Vulkan& vk) {
+    float corners[] = {
+        0.f, 0.f,
+        1.f, 0.f,
+        1.f, 1.f,
+        0.f, 1.f,
+    };
+    uint32_t indices[INDICES_PER_QUAD] = { 0, 1, 2, 2, 3, 0 };
+
+    createVertexBuffer(
+        vk.device, vk.memories, vk.queueFamily, sizeof(corners), textQuad.vBuff
+    );
+    void* dst = mapBufferMemory(
+        vk.device,
+        textQuad.vBuff.handle,
+        textQuad.vBuff.memory
+    );
+        memcpy(dst, corners, sizeof(corners));
+    unMapMemory(vk.device, textQuad.vBuff.memory);
 
-static VulkanPipeline pipeline;
-static VulkanMesh mesh;
-
-void createIndexBuffer(
-    Vulkan& vk,
-    VulkanMesh& mesh
-) {
-    uint32_t data[6];
-    auto count = sizeof(data) / sizeof(uint32_t);
-    auto size = sizeof(uint32_t) * count;
-
-    data[0] = 0;
-    data[1] = 1;
-    data[2] = 2;
-    data[3] = 2;
-    data[4] = 3;
-    data[5] = 0;
-    
     createIndexBuffer(
-        vk.device, vk.memories, vk.queueFamily, (uint32_t)size, mesh.iBuff
+        vk.device, vk.memories, vk.queueFamily, sizeof(indices), textQuad.iBuff
+    );
+    dst = mapBufferMemory(
+        vk.device,
+        textQuad.iBuff.handle,
+        textQuad.iBuff.memory
     );
+        memcpy(dst, indices, sizeof(indices));
+    unMapMemory(vk.device, textQuad.iBuff.memory);
 
-    void *dst = mapBufferMemory(vk.device, mesh.iBuff.handle, mesh.iBuff.memory);
-        memcpy(dst, data, size);
-    unMapMemory(vk.device, mesh.iBuff.memory);
+    textQuad.vCount = VERTICES_PER_QUAD;
+    textQuad.idxCount = INDICES_PER_QUAD;
 }
 
-void createVertexBuffer(
-    Vulkan& vk,
-    uint8_t* buffer,
-    uint32_t quadCount,
-    VulkanPipeline& pipeline,
-    VulkanMesh& mesh
-) {
-    auto count = quadCount * VERTICES_PER_QUAD;
-    auto stride = pipeline.inputBinding.stride;
-    auto size = count * stride;
-
-    float* data = (float*)malloc(size);
-    float* vertex = data;
-    for (uint32_t idx = 0; idx < quadCount * VERTICES_PER_QUAD; idx++) {
-        // NOTE(jan): vertex positions
-        for (int i = 0; i < 3; i++) {
-            *vertex++ = *((float*)buffer);
-            // NOTE(jan): each coord is stored as a 32 bit float
-            buffer += 4;
-        }
-        // NOTE(jan): vertex colours
-        for (int i = 0; i < 4; i++) {
-            *vertex++ = ((uint8_t)*buffer++) / 255.f;
-        }
+void initText(Vulkan& vk) {
+    textPipelines.resize(vk.swap.images.size());
+    for (auto& pipeline: textPipelines) {
+        initVKPipeline(vk, "text", pipeline);
     }
+    createTextQuad(vk);
 
-    createVertexBuffer(
-        vk.device, vk.memories, vk.queueFamily, size, mesh.vBuff
+    textRing.init(
+        vk,
+        sizeof(TextBlock),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
     );
+    for (uint32_t image = 0; image < textPipelines.size(); image++) {
+        textRing.updateDescriptor(
+            vk.device,
+            textPipelines[image].descriptorSet,
+            0,
+            image
+        );
+    }
 
-    void *dst = mapBufferMemory(vk.device, mesh.vBuff.handle, mesh.vBuff.memory);
-        memcpy(dst, data, size);
-    unMapMemory(vk.device, mesh.vBuff.memory);
-
-    mesh.idxCount = count;
-
-    free(data);
+    textBlock.draw.indexCount = INDICES_PER_QUAD;
 }
 
-void
-recordTextCommandBuffers(Vulkan& vk, vector<VkCommandBuffer>& cmds, char* text) {
-    char buffer[99999];
+void updateText(Vulkan& vk, char* text) {
+    EasyFontVertex vertices[TEXT_MAX_GLYPHS * VERTICES_PER_QUAD];
     auto quadCount = stb_easy_font_print(
-        SIZE_X, SIZE_Y, text, NULL, buffer, sizeof(buffer)
+        SIZE_X, SIZE_Y, text, NULL, vertices, sizeof(vertices)
     );
 
-    initVKPipeline(vk, "text", pipeline);
+    // NOTE(jan): stb_easy_font only writes axis aligned quads, starting at
+    // their top left corner and going clockwise.
+    for (int quadIdx = 0; quadIdx < quadCount; quadIdx++) {
+        auto quad = vertices + quadIdx * VERTICES_PER_QUAD;
+        auto& glyph = textBlock.glyphs[quadIdx];
+        glyph.rect[0] = quad[0].x;
+        glyph.rect[1] = quad[0].y;
+        glyph.rect[2] = quad[2].x;
+        glyph.rect[3] = quad[2].y;
+        for (int i = 0; i < 4; i++) {
+            glyph.colour[i] = quad[0].colour[i] / 255.f;
+        }
+    }
+    textBlock.draw.instanceCount = quadCount;
 
-    createVertexBuffer(vk, (uint8_t*)buffer, quadCount, pipeline, mesh);
-    createIndexBuffer(vk, mesh);
+    textRing.push(&textBlock);
+}
 
+void recordTextCommandBuffers(Vulkan& vk, vector<VkCommandBuffer>& cmds) {
     uint32_t framebufferCount = vk.swap.images.size();
     cmds.resize(framebufferCount);
-    createCommandBuffers(vk.device, vk.cmdPoolTransient, framebufferCount, cmds.data());
+    createCommandBuffers(
+        vk.device,
+        vk.cmdPool,
+        framebufferCount,
+        cmds.data()
+    );
     VkDeviceSize offsets[] = {0};
-    for (size_t swapIdx = 0; swapIdx < framebufferCount; swapIdx++) {
+    for (uint32_t swapIdx = 0; swapIdx < framebufferCount; swapIdx++) {
         auto& cmd = cmds[swapIdx];
+        auto& textPipeline = textPipelines[swapIdx];
         beginFrameCommandBuffer(cmd);
+        textRing.recordCopy(cmd, swapIdx);
 
         VkRenderPassBeginInfo beginInfo = {};
         beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -104,29 +150,37 @@ recordTextCommandBuffers(Vulkan& vk, vector<VkCommandBuffer>& cmds, char* text)
         beginInfo.renderPass = vk.renderPassNoClear;
 
         vkCmdBeginRenderPass(cmd, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
-        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.handle);
-        vkCmdBindIndexBuffer(cmd, mesh.iBuff.handle, 0, VK_INDEX_TYPE_UINT32);
-        vkCmdBindVertexBuffers(cmd, 0, 1, &mesh.vBuff.handle, offsets);
-        for (int quadIdx = 0; quadIdx < quadCount; quadIdx++) {
-            vkCmdDrawIndexed(cmd, 6, 1, 0, quadIdx * VERTICES_PER_QUAD, 0);
-        }
+        vkCmdBindPipeline(
+            cmd,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            textPipeline.handle
+        );
+        vkCmdBindDescriptorSets(
+            cmd,
+            VK_PIPELINE_BIND_POINT_GRAPHICS,
+            textPipeline.layout,
+            0, 1,
+            &textPipeline.descriptorSet,
+            0, nullptr
+        );
+        vkCmdBindIndexBuffer(
+            cmd,
+            textQuad.iBuff.handle,
+            0,
+            VK_INDEX_TYPE_UINT32
+        );
+        vkCmdBindVertexBuffers(cmd, 0, 1, &textQuad.vBuff.handle, offsets);
+        // NOTE(jan): Every glyph in one instanced draw, with the count
+        // updateText wrote.
+        vkCmdDrawIndexedIndirect(
+            cmd,
+            textRing.blocks.handle,
+            textRing.offset(swapIdx),
+            1,
+            sizeof(VkDrawIndexedIndirectCommand)
+        );
         vkCmdEndRenderPass(cmd);
 
         VKCHECK(vkEndCommandBuffer(cmd));
     }
 }
-
-void resetTextCommandBuffers(Vulkan& vk, vector<VkCommandBuffer>& cmds) {
-    vkFreeCommandBuffers(
-        vk.device,
-        vk.cmdPoolTransient,
-        cmds.size(),
-        cmds.data()
-    );
-    vkFreeMemory(vk.device, mesh.iBuff.memory, nullptr);
-    vkDestroyBufferView(vk.device, mesh.iBuff.view, nullptr);
-    vkDestroyBuffer(vk.device, mesh.iBuff.handle, nullptr);
-    vkFreeMemory(vk.device, mesh.vBuff.memory, nullptr);
-    vkDestroyBufferView(vk.device, mesh.vBuff.view, nullptr);
-    vkDestroyBuffer(vk.device, mesh.vBuff.handle, nullptr);
-}
@@ -2,16 +2,16 @@
 
 #include "Vulkan.h"
 
-void
-recordTextCommandBuffers(
-    Vulkan& vk,
-    vector<VkCommandBuffer>& cmds,
-    char* text
-);
+// NOTE(jan): Creates the text pipeline and the ring its glyphs stream through.
+void initText(Vulkan& vk);
 
+// NOTE(jan): Replaces the text on screen. Call once per frame, before
+// presenting it.
+void updateText(Vulkan& vk, char* text);
 
-void
-resetTextCommandBuffers(
+// NOTE(jan): Records once, since the glyphs and their count come from the
+// ring.
+void recordTextCommandBuffers(
     Vulkan& vk,
     vector<VkCommandBuffer>& cmds
 );
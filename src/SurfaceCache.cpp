@@ -0,0 +1,486 @@
+#pragma warning(disable: 4267)
+
+#include <algorithm>
+
+#include <emmintrin.h>
+
+#include "SurfaceCache.h"
+
+bool surfaceCacheEnabled = false;
+uint32_t surfaceBudgetMiB = 32;
+
+static int32_t wrapTexel(int32_t texel, int32_t size) {
+    texel %= size;
+    return texel < 0 ? texel + size : texel;
+}
+
+// NOTE(jan): Scales RGBA texels by 8.8 fixed point light, 4 texels at a time,
+// and makes the result opaque.
+static void modulateRow(
+    uint32_t* dst,
+    const uint32_t* colors,
+    const uint16_t* light,
+    uint32_t count
+) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i opaque = _mm_set1_epi32((int32_t)0xFF000000);
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i texels = _mm_loadu_si128((const __m128i*)(colors + i));
+        __m128i lo = _mm_unpacklo_epi8(texels, zero);
+        __m128i hi = _mm_unpackhi_epi8(texels, zero);
+        __m128i lightLo = _mm_set_epi16(
+            light[i + 1], light[i + 1], light[i + 1], light[i + 1],
+            light[i], light[i], light[i], light[i]
+        );
+        __m128i lightHi = _mm_set_epi16(
+            light[i + 3], light[i + 3], light[i + 3], light[i + 3],
+            light[i + 2], light[i + 2], light[i + 2], light[i + 2]
+        );
+        lo = _mm_srli_epi16(_mm_mullo_epi16(lo, lightLo), 8);
+        hi = _mm_srli_epi16(_mm_mullo_epi16(hi, lightHi), 8);
+        _mm_storeu_si128(
+            (__m128i*)(dst + i),
+            _mm_or_si128(_mm_packus_epi16(lo, hi), opaque)
+        );
+    }
+    for (; i < count; i++) {
+        uint32_t color = colors[i];
+        uint32_t r = ((color & 0xFF) * light[i]) >> 8;
+        uint32_t g = (((color >> 8) & 0xFF) * light[i]) >> 8;
+        uint32_t b = (((color >> 16) & 0xFF) * light[i]) >> 8;
+        dst[i] = r | (g << 8) | (b << 16) | 0xFF000000;
+    }
+}
+
+SurfaceCache::SurfaceCache(
+    Vulkan& vk,
+    BSPParser& bsp,
+    Mesh& mesh,
+    LightCompositor& lights
+):
+    vk(vk),
+    textures(bsp.textures->textures),
+    table(bsp.textures->defaultTable),
+    lights(lights),
+    faceLights(mesh.faceLights),
+    frame(1),
+    unmet(0),
+    drainPending(false),
+    uploading(false),
+    cmd(VK_NULL_HANDLE)
+{
+    auto& palette = bsp.textures->palette;
+    for (uint32_t i = 0; i < 256; i++) {
+        auto& color = palette.colors[i];
+        colors[i] = (uint32_t)color.r |
+            ((uint32_t)color.g << 8) |
+            ((uint32_t)color.b << 16) |
+            0xFF000000;
+    }
+
+    // NOTE(jan): Only world faces with a light map get surfaces. Faces
+    // without one are black apart from their fullbrights, which the black
+    // slot drops.
+    auto recordCount = (uint32_t)mesh.faceRecords.size();
+    recordFaces.resize(recordCount, SURFACE_NONE);
+    auto& faceTable = mesh.faceTable;
+    for (uint32_t tableIdx = 0; tableIdx < faceTable.count; tableIdx++) {
+        auto lightIdx = faceTable.lights[tableIdx];
+        auto texSlot = faceTable.texSlots[tableIdx];
+        if ((lightIdx == FACE_LIGHT_NONE) ||
+                textures[texSlot].colorIndices.empty()) {
+            continue;
+        }
+        auto& faceLight = faceLights[lightIdx];
+        auto record = faceTable.records[tableIdx];
+        recordFaces[record] = faces.size();
+        auto& face = faces.emplace_back();
+        face = {};
+        face.record = record;
+        face.texSlot = texSlot;
+        face.light = lightIdx;
+        face.originS = (int32_t)faceLight.uvMin.x * 16;
+        face.originT = (int32_t)faceLight.uvMin.y * 16;
+        face.width = (faceLight.width - 1) * 16;
+        face.height = (faceLight.height - 1) * 16;
+        face.slot = SURFACE_NONE;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(vk.gpu, &properties);
+    VkDeviceSize budget = (VkDeviceSize)surfaceBudgetMiB * 1024 * 1024;
+    auto slotCount = (uint32_t)std::min(
+        budget / SURFACE_SLOT_BYTES,
+        (VkDeviceSize)properties.limits.maxImageArrayLayers
+    );
+    slotCount = std::max(slotCount, 2u);
+    createTextureArray(
+        vk,
+        TEXFORMAT::RGBA8,
+        SURFACE_SLOT_SIZE,
+        SURFACE_SLOT_SIZE,
+        1,
+        slotCount,
+        arrays.emplace_back()
+    );
+    slotOwners.resize(slotCount, SURFACE_NONE);
+    draining.resize(slotCount, false);
+    INFO(
+        "caching %u surfaces of %u faces in %u MiB",
+        slotCount - 1,
+        (uint32_t)faces.size(),
+        surfaceBudgetMiB
+    );
+
+    vector<uint8_t> black(SURFACE_SLOT_BYTES, 0);
+    uploadTextureArrayLayers(vk, arrays[0], 0, 1, black.data(), black.size());
+
+    placementData.resize(std::max(recordCount, 1u));
+    for (auto& placement: placementData) {
+        placement = {};
+        placement.transform = { 0.f, 0.f, .5f, .5f };
+        placement.layer = 0;
+    }
+    placements.init(
+        vk,
+        placementData.size() * sizeof(SurfacePlacement),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+    );
+
+    // NOTE(jan): Stays mapped for the lifetime of the cache.
+    createBuffer(
+        vk,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        SURFACE_BUILDS_PER_FRAME * SURFACE_SLOT_BYTES,
+        staging
+    );
+    mappedStaging = (uint8_t*)mapBufferMemory(
+        vk.device,
+        staging.handle,
+        staging.memory
+    );
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VKCHECK(vkCreateFence(vk.device, &fenceInfo, nullptr, &fence));
+    VKCHECK(vkCreateFence(vk.device, &fenceInfo, nullptr, &drainFence));
+}
+
+SurfaceCache::~SurfaceCache() {
+    if (uploading) {
+        VKCHECK(vkWaitForFences(vk.device, 1, &fence, VK_TRUE, UINT64_MAX));
+        vkFreeCommandBuffers(vk.device, vk.cmdPoolTransient, 1, &cmd);
+    }
+    vkDestroyFence(vk.device, fence, nullptr);
+    vkDestroyFence(vk.device, drainFence, nullptr);
+
+    for (auto& array: arrays) {
+        destroyTextureArray(vk, array);
+    }
+    unMapMemory(vk.device, staging.memory);
+    destroyBuffer(vk, staging);
+    placements.release(vk);
+}
+
+void SurfaceCache::request(uint32_t record, float distance) {
+    auto faceIdx = recordFaces[record];
+    if (faceIdx == SURFACE_NONE) {
+        return;
+    }
+    auto& face = faces[faceIdx];
+    if (face.lastRequested != frame) {
+        face.lastRequested = frame;
+        face.distance = distance;
+        requested.push_back(faceIdx);
+    } else {
+        face.distance = std::min(face.distance, distance);
+    }
+}
+
+uint32_t SurfaceCache::chooseMip(SurfaceFace& face) {
+    uint32_t mip = 0;
+    float threshold = SURFACE_MIP_DISTANCE;
+    while ((face.distance > threshold) && (mip + 1 < MIP_LEVELS)) {
+        mip++;
+        threshold *= 2;
+    }
+    while (((face.width >> mip) > SURFACE_SIZE) ||
+            ((face.height >> mip) > SURFACE_SIZE)) {
+        mip++;
+    }
+    return mip < MIP_LEVELS ? mip : SURFACE_NONE;
+}
+
+void SurfaceCache::evict(uint32_t slot) {
+    auto& face = faces[slotOwners[slot]];
+    // NOTE(jan): Frames in flight may still sample the slot, so it only
+    // becomes reusable once they have finished, see evictUnmet.
+    face.slot = SURFACE_NONE;
+    auto& placement = placementData[face.record];
+    placement.transform = { 0.f, 0.f, .5f, .5f };
+    placement.layer = 0;
+    slotOwners[slot] = SURFACE_NONE;
+    draining[slot] = true;
+}
+
+bool SurfaceCache::acquireSlot(uint32_t& slot) {
+    for (uint32_t i = 1; i < slotOwners.size(); i++) {
+        if ((slotOwners[i] == SURFACE_NONE) && !draining[i]) {
+            slot = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// NOTE(jan): Evicts one surface for every request that found no free slot,
+// least recently requested first. While a drain is pending no more are
+// evicted, since the requests it frees slots for are still waiting.
+void SurfaceCache::evictUnmet() {
+    if (drainPending) {
+        return;
+    }
+    bool evicted = false;
+    for (; unmet > 0; unmet--) {
+        uint32_t victim = SURFACE_NONE;
+        uint64_t oldest = frame;
+        for (uint32_t i = 1; i < slotOwners.size(); i++) {
+            auto owner = slotOwners[i];
+            if ((owner != SURFACE_NONE) &&
+                    (faces[owner].lastRequested < oldest)) {
+                oldest = faces[owner].lastRequested;
+                victim = i;
+            }
+        }
+        // NOTE(jan): Surfaces requested this frame are never evicted.
+        if (victim == SURFACE_NONE) {
+            break;
+        }
+        evict(victim);
+        evicted = true;
+    }
+    unmet = 0;
+    if (!evicted) {
+        return;
+    }
+    // NOTE(jan): This frame's placements, pushed at the end of update, and
+    // every later frame's send the evicted faces to the black slot. An empty
+    // submission then signals its fence once every frame before this one has
+    // finished.
+    VKCHECK(vkQueueSubmit(vk.queue, 0, nullptr, drainFence));
+    drainPending = true;
+}
+
+void SurfaceCache::retireDrain() {
+    if (vkGetFenceStatus(vk.device, drainFence) != VK_SUCCESS) {
+        return;
+    }
+    VKCHECK(vkResetFences(vk.device, 1, &drainFence));
+    std::fill(draining.begin(), draining.end(), false);
+    drainPending = false;
+}
+
+void SurfaceCache::place(uint32_t faceIdx) {
+    auto& face = faces[faceIdx];
+    float texelSize = (float)(1 << face.mip);
+    float scale = 1.f / (texelSize * SURFACE_SLOT_SIZE);
+    auto& placement = placementData[face.record];
+    placement.transform = {
+        scale,
+        scale,
+        (SURFACE_BORDER - face.originS / texelSize) / SURFACE_SLOT_SIZE,
+        (SURFACE_BORDER - face.originT / texelSize) / SURFACE_SLOT_SIZE
+    };
+    placement.layer = face.slot;
+}
+
+void SurfaceCache::build(SurfaceBuild& build) {
+    auto& face = faces[build.face];
+    auto& faceLight = faceLights[face.light];
+    auto& texture = textures[build.frameSlot];
+    auto mip = build.mip;
+
+    auto indices = texture.colorIndices.data();
+    for (uint32_t level = 0; level < mip; level++) {
+        indices += mipTexelCount(texture.width, texture.height, level);
+    }
+    auto texWidth = (int32_t)(texture.width >> mip);
+    auto texHeight = (int32_t)(texture.height >> mip);
+    auto originS = face.originS / (1 << mip) - (int32_t)SURFACE_BORDER;
+    auto originT = face.originT / (1 << mip) - (int32_t)SURFACE_BORDER;
+    auto width = (face.width >> mip) + 2 * SURFACE_BORDER;
+    auto height = (face.height >> mip) + 2 * SURFACE_BORDER;
+
+    // NOTE(jan): Light map texels sit on every 16th texture texel, and are
+    // filtered between like the hardware does in the default renderer.
+    auto lightTexels = lights.texels.data() +
+        faceLight.y * lights.width + faceLight.x;
+    auto lightStride = lights.width;
+    float luxelsPerTexel = (1 << mip) / 16.f;
+    auto maxS = (float)(faceLight.width - 1);
+    auto maxT = (float)(faceLight.height - 1);
+
+    uint32_t rowColors[SURFACE_SLOT_SIZE];
+    uint16_t rowLight[SURFACE_SLOT_SIZE];
+    auto dst = (uint32_t*)(mappedStaging + build.offset);
+    for (uint32_t y = 0; y < height; y++) {
+        float t = ((int32_t)y - (int32_t)SURFACE_BORDER + .5f) * luxelsPerTexel;
+        t = std::min(std::max(t, 0.f), maxT);
+        auto t0 = (uint32_t)t;
+        auto t1 = std::min(t0 + 1, faceLight.height - 1);
+        float tLerp = t - t0;
+        auto top = lightTexels + t0 * lightStride;
+        auto bottom = lightTexels + t1 * lightStride;
+        auto srcRow = indices + wrapTexel(originT + (int32_t)y, texHeight) * texWidth;
+
+        for (uint32_t x = 0; x < width; x++) {
+            float s = ((int32_t)x - (int32_t)SURFACE_BORDER + .5f) * luxelsPerTexel;
+            s = std::min(std::max(s, 0.f), maxS);
+            auto s0 = (uint32_t)s;
+            auto s1 = std::min(s0 + 1, faceLight.width - 1);
+            float sLerp = s - s0;
+            float upper = top[s0] + (top[s1] - top[s0]) * sLerp;
+            float lower = bottom[s0] + (bottom[s1] - bottom[s0]) * sLerp;
+            float light = upper + (lower - upper) * tLerp;
+
+            auto colorIdx = srcRow[wrapTexel(originS + (int32_t)x, texWidth)];
+            rowColors[x] = colors[colorIdx];
+            // NOTE(jan): Light map texels are 0--255, the modulation 0--256.
+            rowLight[x] = colorIdx >= FULLBRIGHT_START ?
+                256 : (uint16_t)(light * (256.f / 255.f) + .5f);
+        }
+        modulateRow(dst + y * width, rowColors, rowLight, width);
+    }
+}
+
+void SurfaceCache::update(float elapsedS) {
+    updateSlots(elapsedS);
+    // NOTE(jan): Every frame, since each swap image has its own copy.
+    placements.push(placementData.data());
+}
+
+void SurfaceCache::updateSlots(float elapsedS) {
+    for (auto record: lights.changedRecords) {
+        auto faceIdx = recordFaces[record];
+        if (faceIdx != SURFACE_NONE) {
+            faces[faceIdx].stale = true;
+        }
+    }
+
+    if (drainPending) {
+        retireDrain();
+    }
+    if (uploading) {
+        if (vkGetFenceStatus(vk.device, fence) != VK_SUCCESS) {
+            requested.clear();
+            frame++;
+            return;
+        }
+        VKCHECK(vkResetFences(vk.device, 1, &fence));
+        vkFreeCommandBuffers(vk.device, vk.cmdPoolTransient, 1, &cmd);
+        cmd = VK_NULL_HANDLE;
+        uploading = false;
+    }
+
+    // NOTE(jan): Closest faces first, since they are the most noticeable
+    // when their surface is missing or blurry.
+    std::sort(
+        requested.begin(),
+        requested.end(),
+        [this](uint32_t a, uint32_t b) {
+            return faces[a].distance < faces[b].distance;
+        }
+    );
+    builds.clear();
+    for (auto faceIdx: requested) {
+        if (builds.size() == SURFACE_BUILDS_PER_FRAME) {
+            break;
+        }
+        auto& face = faces[faceIdx];
+        auto mip = chooseMip(face);
+        if (mip == SURFACE_NONE) {
+            continue;
+        }
+        auto frameSlot = resolveTextureFrame(table, face.texSlot, elapsedS);
+        if ((face.slot != SURFACE_NONE) &&
+                !face.stale &&
+                (face.mip == mip) &&
+                (face.frameSlot == frameSlot)) {
+            continue;
+        }
+        // NOTE(jan): Surfaces are rebuilt in place. The copy is ordered after
+        // the frames in flight that sample the old one.
+        auto slot = face.slot;
+        if ((slot == SURFACE_NONE) && !acquireSlot(slot)) {
+            unmet++;
+            continue;
+        }
+        slotOwners[slot] = faceIdx;
+        face.slot = slot;
+        builds.push_back({
+            faceIdx,
+            slot,
+            mip,
+            frameSlot,
+            builds.size() * SURFACE_SLOT_BYTES
+        });
+    }
+    evictUnmet();
+    requested.clear();
+    frame++;
+    if (builds.empty()) {
+        return;
+    }
+
+    // NOTE(jan): Builds read the light compositor's atlas, which the next
+    // update changes, so they finish before returning.
+    auto& jobs = getJobSystem();
+    JobCounter counter;
+    for (auto& surfaceBuild: builds) {
+        jobs.submit(counter, [this, &surfaceBuild]() {
+            build(surfaceBuild);
+        });
+    }
+    jobs.wait(counter);
+
+    cmd = beginOneShotCommandBuffer(vk);
+    vector<VkBufferImageCopy> regions(1);
+    for (auto& surfaceBuild: builds) {
+        auto& face = faces[surfaceBuild.face];
+        auto& region = regions[0];
+        region = {};
+        region.bufferOffset = surfaceBuild.offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = surfaceBuild.slot;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = {
+            (face.width >> surfaceBuild.mip) + 2 * SURFACE_BORDER,
+            (face.height >> surfaceBuild.mip) + 2 * SURFACE_BORDER,
+            1
+        };
+        recordTextureArrayRegionCopies(
+            cmd,
+            arrays[0],
+            surfaceBuild.slot,
+            staging.handle,
+            regions
+        );
+
+        face.mip = surfaceBuild.mip;
+        face.frameSlot = surfaceBuild.frameSlot;
+        face.stale = false;
+        place(surfaceBuild.face);
+    }
+    VKCHECK(vkEndCommandBuffer(cmd));
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmd;
+    VKCHECK(vkQueueSubmit(vk.queue, 1, &submitInfo, fence));
+    uploading = true;
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <vector>
+
+#include "BSPParser.h"
+#include "JobSystem.h"
+#include "LightCompositor.h"
+#include "Mesh.h"
+#include "TexturePacker.h"
+#include "UniformRing.h"
+#include "VulkanResources.h"
+
+using std::vector;
+
+// NOTE(jan): Set from the command line with -surfacecache, with the cache
+// size set with -surfacebudget <MiB>.
+extern bool surfaceCacheEnabled;
+extern uint32_t surfaceBudgetMiB;
+
+// NOTE(jan): Largest surface, in texels of the mip level it is built at.
+// Quake limits face extents to 256 texels, so every face fits from mip 1.
+const uint32_t SURFACE_SIZE = 128;
+// NOTE(jan): Texels built beyond each edge, so filtering stays inside the
+// surface.
+const uint32_t SURFACE_BORDER = 1;
+const uint32_t SURFACE_SLOT_SIZE = SURFACE_SIZE + 2 * SURFACE_BORDER;
+const VkDeviceSize SURFACE_SLOT_BYTES =
+    SURFACE_SLOT_SIZE * SURFACE_SLOT_SIZE * 4;
+// NOTE(jan): Surfaces built per frame, the rest wait for later frames.
+const uint32_t SURFACE_BUILDS_PER_FRAME = 128;
+// NOTE(jan): Surfaces drop a mip level at this distance, and another every
+// time it doubles.
+const float SURFACE_MIP_DISTANCE = 256.f;
+const uint32_t SURFACE_NONE = 0xFFFFFFFF;
+
+// NOTE(jan): Laid out to match SurfacePlacement in surface.vert, following
+// std430 rules. Maps a face's texture coordinates into its surface.
+struct SurfacePlacement {
+    // NOTE(jan): Scale in xy, bias in zw.
+    glm::vec4 transform;
+    // NOTE(jan): Layer of the surface array, which is the surface's slot.
+    uint32_t layer;
+    uint32_t padding[3];
+};
+
+struct SurfaceFace {
+    uint32_t record;
+    uint32_t texSlot;
+    // NOTE(jan): Index into Mesh::faceLights.
+    uint32_t light;
+    // NOTE(jan): Texture coordinates of the surface's corner, and its size,
+    // in texels of the largest mip level.
+    int32_t originS;
+    int32_t originT;
+    uint32_t width;
+    uint32_t height;
+
+    uint32_t slot;
+    uint32_t mip;
+    uint32_t frameSlot;
+    bool stale;
+    uint64_t lastRequested;
+    uint32_t wantedMip;
+    float distance;
+};
+
+struct SurfaceBuild {
+    uint32_t face;
+    uint32_t slot;
+    uint32_t mip;
+    uint32_t frameSlot;
+    VkDeviceSize offset;
+};
+
+/* NOTE(jan): Quake's software renderer lit each face once into a surface that
+   combined its texture and light map, and kept those surfaces in a cache. This
+   does the same for faces with light maps. Visible faces request a surface at
+   a mip level picked by distance, which is built on the job system and kept
+   in a texture array slot until it is evicted least recently requested first.
+   Surfaces are rebuilt when the face's light styles or animation frame
+   change. surface.frag then only samples the surface.
+
+   Every slot is a layer of one array, so the shader never picks between
+   arrays per face, which would need non-uniform indexing. The slot count is
+   capped by the device's array layer limit. */
+struct SurfaceCache {
+    // NOTE(jan): The single surface array.
+    vector<VulkanTextureArray> arrays;
+    // NOTE(jan): One per face record, faces without a surface sample a black
+    // slot. Streamed every frame, since frames in flight read it.
+    UniformRing placements;
+
+    SurfaceCache(
+        Vulkan& vk,
+        BSPParser& bsp,
+        Mesh& mesh,
+        LightCompositor& lights
+    );
+    // NOTE(jan): The device must be idle.
+    ~SurfaceCache();
+
+    void request(uint32_t record, float distance);
+    // NOTE(jan): Call once per frame, after the light compositor and the
+    // requests for that frame.
+    void update(float elapsedS);
+
+private:
+    Vulkan& vk;
+    vector<Texture>& textures;
+    TextureTable& table;
+    LightCompositor& lights;
+    // NOTE(jan): Opaque RGBA8 for each palette index.
+    uint32_t colors[256];
+    vector<FaceLight> faceLights;
+    uint64_t frame;
+
+    vector<SurfaceFace> faces;
+    vector<uint32_t> recordFaces;
+    vector<uint32_t> requested;
+    // NOTE(jan): Face held by each slot. Slot 0 is the black one.
+    vector<uint32_t> slotOwners;
+    // NOTE(jan): Evicted slots that frames in flight may still sample. They
+    // become free once drainFence signals.
+    vector<bool> draining;
+    // NOTE(jan): Requests this update that found no free slot.
+    uint32_t unmet;
+    VkFence drainFence;
+    bool drainPending;
+    vector<SurfacePlacement> placementData;
+
+    vector<SurfaceBuild> builds;
+    VulkanBuffer staging;
+    uint8_t* mappedStaging;
+    bool uploading;
+    VkCommandBuffer cmd;
+    VkFence fence;
+
+    uint32_t chooseMip(SurfaceFace& face);
+    bool acquireSlot(uint32_t& slot);
+    void evict(uint32_t slot);
+    void evictUnmet();
+    void retireDrain();
+    void place(uint32_t faceIdx);
+    // NOTE(jan): Everything update does apart from pushing the placements.
+    void updateSlots(float elapsedS);
+    void build(SurfaceBuild& build);
+};
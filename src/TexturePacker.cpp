@@ -0,0 +1,37 @@
+#include "TexturePacker.h"
+#include "VulkanResources.h"
+
+TexturePacker::TexturePacker(vector<Texture>& textures) {
+    locations.resize(textures.size());
+
+    for (uint32_t texIdx = 0; texIdx < textures.size(); texIdx++) {
+        auto& texture = textures[texIdx];
+
+        uint32_t arrayIdx = 0;
+        for (; arrayIdx < arrays.size(); arrayIdx++) {
+            auto& array = arrays[arrayIdx];
+            if ((array.width == texture.width) &&
+                    (array.height == texture.height) &&
+                    (array.mipLevels == texture.mipLevels) &&
+                    (array.format == texture.format)) {
+                break;
+            }
+        }
+        if (arrayIdx == arrays.size()) {
+            auto& array = arrays.emplace_back();
+            array.width = texture.width;
+            array.height = texture.height;
+            array.mipLevels = texture.mipLevels;
+            array.format = texture.format;
+        }
+
+        auto& array = arrays[arrayIdx];
+        auto layer = (uint32_t)array.members.size();
+        array.members.push_back(texIdx);
+        locations[texIdx] = packTextureLocation(arrayIdx, layer);
+    }
+
+    if (arrays.size() > MAX_TEXTURE_ARRAYS) {
+        throw runtime_error("too many texture size classes");
+    }
+}
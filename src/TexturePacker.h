@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+
+#include "BSPTextureParser.h"
+
+using std::vector;
+
+/* NOTE(jan): Textures are packed into 2D array images, one per size class.
+   A texture's location is the array index in the top 16 bits and the layer
+   in the bottom 16 bits, see default.frag. */
+inline uint32_t packTextureLocation(uint32_t array, uint32_t layer) {
+    return (array << 16) | layer;
+}
+
+struct TextureArrayLayout {
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    TEXFORMAT format;
+    // NOTE(jan): Indices of the textures stored in each layer.
+    vector<uint32_t> members;
+};
+
+struct TexturePacker {
+    vector<TextureArrayLayout> arrays;
+    // NOTE(jan): Packed location of each input texture.
+    vector<uint32_t> locations;
+
+    TexturePacker(vector<Texture>&);
+};
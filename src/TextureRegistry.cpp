@@ -0,0 +1,238 @@
+#pragma warning(disable: 4267)
+
+#include "TextureRegistry.h"
+
+bool TextureRegistry::contains(uint64_t hash) {
+    return entries.find(hash) != entries.end();
+}
+
+RegistryEntry& TextureRegistry::find(uint64_t hash) {
+    auto it = entries.find(hash);
+    if (it == entries.end()) {
+        throw runtime_error("texture is not registered");
+    }
+    return it->second;
+}
+
+void TextureRegistry::release(uint64_t hash) {
+    auto& entry = find(hash);
+    entry.refCount--;
+    if (entry.refCount > 0) {
+        return;
+    }
+    // NOTE(jan): Callers wait for the device to go idle before releasing a
+    // map, so the layer can be reused straight away. Once every layer of an
+    // array is free, allocateLayer recycles the whole array.
+    if (entry.ownsLayer) {
+        auto arrayIdx = entry.location >> 16;
+        auto layer = entry.location & 0xFFFF;
+        freeLayers[arrayIdx].push_back(layer);
+    }
+    entries.erase(hash);
+}
+
+void TextureRegistry::trim(Vulkan& vk) {
+    while (!arrays.empty() &&
+            (freeLayers.back().size() == REGISTRY_ARRAY_LAYERS)) {
+        destroyTextureArray(vk, arrays.back());
+        arrays.pop_back();
+        freeLayers.pop_back();
+    }
+}
+
+uint32_t TextureRegistry::spareArrays() {
+    uint32_t spare = MAX_TEXTURE_ARRAYS - arrays.size();
+    for (auto& free: freeLayers) {
+        if (free.size() == REGISTRY_ARRAY_LAYERS) {
+            spare++;
+        }
+    }
+    return spare;
+}
+
+bool TextureRegistry::allocateLayer(
+    Vulkan& vk,
+    TEXFORMAT format,
+    uint32_t width,
+    uint32_t height,
+    uint32_t mipLevels,
+    uint32_t& location
+) {
+    for (uint32_t arrayIdx = 0; arrayIdx < arrays.size(); arrayIdx++) {
+        auto& array = arrays[arrayIdx];
+        auto& free = freeLayers[arrayIdx];
+        if ((array.format == format) &&
+                (array.width == width) &&
+                (array.height == height) &&
+                (array.mipLevels == mipLevels) &&
+                !free.empty()) {
+            auto layer = free.back();
+            free.pop_back();
+            location = packTextureLocation(arrayIdx, layer);
+            return true;
+        }
+    }
+
+    // NOTE(jan): Arrays that no map uses any more are recreated for the new
+    // size class, so that they do not pile up until the limit is hit. Their
+    // index stays the same, so the locations of other arrays are unaffected.
+    uint32_t arrayIdx = 0;
+    while ((arrayIdx < arrays.size()) &&
+            (freeLayers[arrayIdx].size() < REGISTRY_ARRAY_LAYERS)) {
+        arrayIdx++;
+    }
+    if (arrayIdx < arrays.size()) {
+        // NOTE(jan): The previous map is still drawing while this one loads,
+        // and its descriptor sets still bind the array.
+        VKCHECK(vkDeviceWaitIdle(vk.device));
+        destroyTextureArray(vk, arrays[arrayIdx]);
+        freeLayers[arrayIdx].clear();
+    } else if (arrays.size() == MAX_TEXTURE_ARRAYS) {
+        return false;
+    } else {
+        arrays.emplace_back();
+        freeLayers.emplace_back();
+    }
+    createTextureArray(
+        vk,
+        format,
+        width,
+        height,
+        mipLevels,
+        REGISTRY_ARRAY_LAYERS,
+        arrays[arrayIdx]
+    );
+    auto& free = freeLayers[arrayIdx];
+    for (uint32_t layer = REGISTRY_ARRAY_LAYERS; layer > 1; layer--) {
+        free.push_back(layer - 1);
+    }
+    location = packTextureLocation(arrayIdx, 0);
+    return true;
+}
+
+void TextureRegistry::uploadLayers(Vulkan& vk, vector<RegistryUpload>& uploads) {
+    if (uploads.empty()) {
+        return;
+    }
+
+    VkDeviceSize size = 0;
+    for (auto& upload: uploads) {
+        size += upload.size;
+    }
+    VulkanBuffer staging;
+    createBuffer(
+        vk,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        size,
+        staging
+    );
+    auto dst = (uint8_t*)mapBufferMemory(
+        vk.device,
+        staging.handle,
+        staging.memory
+    );
+        for (auto& upload: uploads) {
+            memcpy(dst, upload.data, upload.size);
+            dst += upload.size;
+        }
+    unMapMemory(vk.device, staging.memory);
+
+    auto cmd = beginOneShotCommandBuffer(vk);
+    VkDeviceSize offset = 0;
+    for (auto& upload: uploads) {
+        recordTextureArrayLayerCopy(
+            cmd,
+            arrays[upload.location >> 16],
+            upload.location & 0xFFFF,
+            staging.handle,
+            offset
+        );
+        offset += upload.size;
+    }
+    endOneShotCommandBuffer(vk, cmd);
+
+    destroyBuffer(vk, staging);
+}
+
+void TextureRegistry::acquireClass(
+    Vulkan& vk,
+    vector<Texture>& textures,
+    TextureArrayLayout& layout,
+    uint32_t firstLevel,
+    vector<uint32_t>& locations
+) {
+    VkDeviceSize streamedSize = 0;
+    for (uint32_t level = 0; level < firstLevel; level++) {
+        streamedSize += mipByteSize(
+            layout.format,
+            layout.width,
+            layout.height,
+            level
+        );
+    }
+
+    vector<RegistryUpload> uploads;
+    uint32_t borrowed = 0;
+    for (auto texSlot: layout.members) {
+        auto& texture = textures[texSlot];
+        auto it = entries.find(texture.hash);
+        // NOTE(jan): Textures that borrowed a layer try for their own again.
+        if ((it != entries.end()) && it->second.ownsLayer) {
+            it->second.refCount++;
+            locations[texSlot] = it->second.location;
+            continue;
+        }
+        if (texture.texels.empty()) {
+            throw runtime_error("texture was released before it was acquired");
+        }
+
+        auto& entry = entries[texture.hash];
+        entry.refCount++;
+        entry.ownsLayer = allocateLayer(
+            vk,
+            layout.format,
+            layout.width >> firstLevel,
+            layout.height >> firstLevel,
+            layout.mipLevels - firstLevel,
+            entry.location
+        );
+        entry.streamedTexels.assign(
+            texture.texels.begin(),
+            texture.texels.begin() + streamedSize
+        );
+        if (!entry.ownsLayer) {
+            entry.location = packTextureLocation(0, 0);
+            locations[texSlot] = entry.location;
+            borrowed++;
+            continue;
+        }
+        locations[texSlot] = entry.location;
+
+        auto& upload = uploads.emplace_back();
+        upload.location = entry.location;
+        upload.data = texture.texels.data() + streamedSize;
+        upload.size = texture.texels.size() - streamedSize;
+    }
+    uploadLayers(vk, uploads);
+    if (borrowed) {
+        INFO(
+            "no texture array left for %u textures of %ux%u",
+            borrowed,
+            layout.width >> firstLevel,
+            layout.height >> firstLevel
+        );
+    }
+
+    // NOTE(jan): The registry holds everything that is needed from here on.
+    for (auto texSlot: layout.members) {
+        textures[texSlot].texels.clear();
+        textures[texSlot].texels.shrink_to_fit();
+    }
+}
+
+TextureRegistry& getTextureRegistry() {
+    static TextureRegistry registry;
+    return registry;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "BSPTextureParser.h"
+#include "TexturePacker.h"
+#include "VulkanResources.h"
+
+using std::unordered_map;
+using std::vector;
+
+// NOTE(jan): Layers per registry array. Full arrays get a sibling of the
+// same size class rather than growing.
+const uint32_t REGISTRY_ARRAY_LAYERS = 64;
+
+struct RegistryEntry {
+    uint32_t location;
+    uint32_t refCount;
+    // NOTE(jan): False for textures that found no layer because every array
+    // slot was taken. They borrow the first layer of the first array rather
+    // than failing the load.
+    bool ownsLayer;
+    // NOTE(jan): Levels above the resident ones, kept in system memory so
+    // they can be streamed in again, see TextureStreamer.
+    vector<uint8_t> streamedTexels;
+};
+
+struct RegistryUpload {
+    uint32_t location;
+    uint8_t* data;
+    VkDeviceSize size;
+};
+
+/* NOTE(jan): Texture arrays shared by every loaded map, keyed by content
+   hash. A map acquires each of its textures, and only textures that are not
+   resident yet are uploaded. Layers are freed once the last map using them
+   releases them, and reused by the next map that needs their size class.
+   Arrays left with no layers in use are recreated for the next class that
+   needs a new one.
+
+   Registry arrays share the shaders' MAX_TEXTURE_ARRAYS table with the
+   streaming pools, see spareArrays. */
+struct TextureRegistry {
+    vector<VulkanTextureArray> arrays;
+
+    bool contains(uint64_t hash);
+    RegistryEntry& find(uint64_t hash);
+    void release(uint64_t hash);
+    // NOTE(jan): How many arrays can still be created or recycled for a new
+    // size class.
+    uint32_t spareArrays();
+    // NOTE(jan): Destroys the empty arrays at the end, so that the streaming
+    // pools that follow the registry arrays get their entries back. The device
+    // must be idle, and no streamer may hold the arrays.
+    void trim(Vulkan& vk);
+
+    // NOTE(jan): Acquires every texture of a size class, uploading mip
+    // levels firstLevel and below of those that are not resident.
+    void acquireClass(
+        Vulkan& vk,
+        vector<Texture>& textures,
+        TextureArrayLayout& layout,
+        uint32_t firstLevel,
+        vector<uint32_t>& locations
+    );
+
+private:
+    unordered_map<uint64_t, RegistryEntry> entries;
+    vector<vector<uint32_t>> freeLayers;
+
+    // NOTE(jan): Returns false when every array slot is taken.
+    bool allocateLayer(
+        Vulkan& vk,
+        TEXFORMAT format,
+        uint32_t width,
+        uint32_t height,
+        uint32_t mipLevels,
+        uint32_t& location
+    );
+    void uploadLayers(Vulkan& vk, vector<RegistryUpload>& uploads);
+};
+
+TextureRegistry& getTextureRegistry();
@@ -0,0 +1,352 @@
+#pragma warning(disable: 4267)
+
+#include <algorithm>
+
+#include "TextureRegistry.h"
+#include "TextureStreamer.h"
+
+uint32_t textureBudgetMiB = 64;
+
+TextureStreamer::TextureStreamer(
+    Vulkan& vk,
+    vector<Texture>& textures,
+    TexturePacker& packer,
+    vector<JobCounter>& decodes,
+    TextureTable& table
+):
+    vk(vk),
+    textures(textures),
+    table(table),
+    frame(1),
+    state(STREAM_IDLE),
+    cmd(VK_NULL_HANDLE),
+    drainPending(false)
+{
+    auto& jobs = getJobSystem();
+    auto& registry = getTextureRegistry();
+    auto count = (uint32_t)textures.size();
+    residentLocations.resize(count);
+    texturePools.resize(count, STREAMING_NONE);
+    streamedLayers.resize(count, STREAMING_NONE);
+    lastRequested.resize(count, 0);
+    sources.resize(count, nullptr);
+
+    vector<uint32_t> streamedClasses;
+    VkDeviceSize streamedBytes = 0;
+    for (size_t classIdx = 0; classIdx < packer.arrays.size(); classIdx++) {
+        auto& layout = packer.arrays[classIdx];
+        bool streamed = (layout.mipLevels > 1) &&
+            (layout.width >= STREAMING_MIN_SIZE) &&
+            (layout.height >= STREAMING_MIN_SIZE);
+
+        // NOTE(jan): Later arrays keep decoding while this one uploads.
+        jobs.wait(decodes[classIdx]);
+        registry.acquireClass(
+            vk,
+            textures,
+            layout,
+            streamed ? 1 : 0,
+            residentLocations
+        );
+
+        if (streamed) {
+            streamedClasses.push_back(classIdx);
+            streamedBytes += (VkDeviceSize)layout.members.size() *
+                mipByteSize(layout.format, layout.width, layout.height, 0);
+            for (auto texSlot: layout.members) {
+                auto& entry = registry.find(textures[texSlot].hash);
+                sources[texSlot] = &entry.streamedTexels;
+            }
+        }
+    }
+    arrays = registry.arrays;
+
+    // NOTE(jan): Each pool gets a share of the budget proportional to the
+    // size of its class.
+    VkDeviceSize budget = (VkDeviceSize)textureBudgetMiB * 1024 * 1024;
+    stagingSize = STREAMING_STAGING_SIZE;
+    uint32_t skippedPools = 0;
+    for (auto classIdx: streamedClasses) {
+        auto& layout = packer.arrays[classIdx];
+        uint32_t members = layout.members.size();
+        uint32_t capacity = members;
+        if (budget < streamedBytes) {
+            capacity = (uint32_t)(members * budget / streamedBytes);
+        }
+        if (capacity == 0) {
+            continue;
+        }
+        // NOTE(jan): Pools share the shaders' array table with the registry.
+        // Without a free entry the class keeps its resident mips only.
+        if (arrays.size() == MAX_TEXTURE_ARRAYS) {
+            skippedPools++;
+            continue;
+        }
+
+        VkDeviceSize layerSize = mipByteSize(
+            layout.format,
+            layout.width,
+            layout.height,
+            0
+        );
+        uint32_t poolIdx = pools.size();
+        auto& pool = pools.emplace_back();
+        pool.arrayIdx = arrays.size();
+        pool.layerSize = layerSize;
+        pool.owners.resize(capacity, STREAMING_NONE);
+        pool.draining.resize(capacity, false);
+        pool.unmet = 0;
+        createTextureArray(
+            vk,
+            layout.format,
+            layout.width,
+            layout.height,
+            1,
+            capacity,
+            arrays.emplace_back()
+        );
+        for (auto texSlot: layout.members) {
+            texturePools[texSlot] = poolIdx;
+        }
+        stagingSize = std::max(stagingSize, layerSize);
+    }
+    if (skippedPools) {
+        INFO("no texture array left for %u streaming pools", skippedPools);
+    }
+    INFO(
+        "streaming %llu MiB of textures in %u pools with a %u MiB budget",
+        (unsigned long long)(streamedBytes / (1024 * 1024)),
+        (uint32_t)pools.size(),
+        textureBudgetMiB
+    );
+
+    locationData = residentLocations;
+    locationData.resize(std::max(count, 4u), 0);
+    locations.init(
+        vk,
+        locationData.size() * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+    );
+
+    // NOTE(jan): Stays mapped for the lifetime of the streamer.
+    createBuffer(
+        vk,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        stagingSize,
+        staging
+    );
+    mappedStaging = (uint8_t*)mapBufferMemory(
+        vk.device,
+        staging.handle,
+        staging.memory
+    );
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VKCHECK(vkCreateFence(vk.device, &fenceInfo, nullptr, &fence));
+    VKCHECK(vkCreateFence(vk.device, &fenceInfo, nullptr, &drainFence));
+}
+
+TextureStreamer::~TextureStreamer() {
+    getJobSystem().wait(fill);
+    if (state == STREAM_UPLOADING) {
+        VKCHECK(vkWaitForFences(vk.device, 1, &fence, VK_TRUE, UINT64_MAX));
+        vkFreeCommandBuffers(vk.device, vk.cmdPoolTransient, 1, &cmd);
+    }
+    vkDestroyFence(vk.device, fence, nullptr);
+    vkDestroyFence(vk.device, drainFence, nullptr);
+
+    for (auto& pool: pools) {
+        destroyTextureArray(vk, arrays[pool.arrayIdx]);
+    }
+    unMapMemory(vk.device, staging.memory);
+    destroyBuffer(vk, staging);
+    locations.release(vk);
+}
+
+void TextureStreamer::touch(uint32_t texSlot) {
+    lastRequested[texSlot] = frame;
+}
+
+void TextureStreamer::request(uint32_t texSlot) {
+    auto& animation = table.animations[texSlot];
+    for (uint32_t i = 0; i < animation.frameCount; i++) {
+        touch(table.frames[animation.firstFrame + i]);
+    }
+}
+
+void TextureStreamer::update() {
+    if (drainPending) {
+        retireDrain();
+    }
+    if (state == STREAM_UPLOADING) {
+        retireBatch();
+    }
+    if ((state == STREAM_FILLING) && (fill.pending == 0)) {
+        submitBatch();
+    }
+    if (state == STREAM_IDLE) {
+        beginBatch();
+    }
+    frame++;
+    // NOTE(jan): Every frame, since each swap image has its own copy.
+    locations.push(locationData.data());
+}
+
+void TextureStreamer::evict(uint32_t poolIdx, uint32_t layer) {
+    auto& pool = pools[poolIdx];
+    auto owner = pool.owners[layer];
+    // NOTE(jan): Frames submitted from now on sample the resident mips, but
+    // frames in flight may still sample the layer, so it drains first.
+    locationData[owner] = residentLocations[owner];
+    streamedLayers[owner] = STREAMING_NONE;
+    pool.owners[layer] = STREAMING_NONE;
+    pool.draining[layer] = true;
+}
+
+bool TextureStreamer::acquireLayer(uint32_t poolIdx, uint32_t& layer) {
+    auto& pool = pools[poolIdx];
+    for (uint32_t i = 0; i < pool.owners.size(); i++) {
+        if ((pool.owners[i] == STREAMING_NONE) && !pool.draining[i]) {
+            layer = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* NOTE(jan): Evicts one layer for each request that found no free layer,
+   least recently requested first. Requests retry every frame, so nothing more
+   is evicted while a drain is in flight, otherwise each texture would cost an
+   eviction for every frame it waited. */
+void TextureStreamer::evictUnmet() {
+    if (drainPending) {
+        return;
+    }
+    bool evicted = false;
+    for (uint32_t poolIdx = 0; poolIdx < pools.size(); poolIdx++) {
+        auto& pool = pools[poolIdx];
+        for (; pool.unmet > 0; pool.unmet--) {
+            uint32_t victim = STREAMING_NONE;
+            uint64_t oldest = frame;
+            for (uint32_t i = 0; i < pool.owners.size(); i++) {
+                auto owner = pool.owners[i];
+                if ((owner != STREAMING_NONE) &&
+                        (lastRequested[owner] < oldest)) {
+                    oldest = lastRequested[owner];
+                    victim = i;
+                }
+            }
+            // NOTE(jan): Textures requested this frame are never evicted.
+            if (victim == STREAMING_NONE) {
+                pool.unmet = 0;
+                break;
+            }
+            evict(poolIdx, victim);
+            evicted = true;
+        }
+    }
+    if (!evicted) {
+        return;
+    }
+    // NOTE(jan): An empty submission signals its fence once everything
+    // submitted to the queue before it has finished, which covers every
+    // frame that could have read the evicted layers.
+    VKCHECK(vkQueueSubmit(vk.queue, 0, nullptr, drainFence));
+    drainPending = true;
+}
+
+void TextureStreamer::retireDrain() {
+    if (vkGetFenceStatus(vk.device, drainFence) != VK_SUCCESS) {
+        return;
+    }
+    VKCHECK(vkResetFences(vk.device, 1, &drainFence));
+    for (auto& pool: pools) {
+        std::fill(pool.draining.begin(), pool.draining.end(), false);
+    }
+    drainPending = false;
+}
+
+void TextureStreamer::beginBatch() {
+    VkDeviceSize offset = 0;
+    uploads.clear();
+    for (auto& pool: pools) {
+        pool.unmet = 0;
+    }
+    for (uint32_t texSlot = 0; texSlot < textures.size(); texSlot++) {
+        auto poolIdx = texturePools[texSlot];
+        if ((lastRequested[texSlot] != frame) ||
+                (poolIdx == STREAMING_NONE) ||
+                (streamedLayers[texSlot] != STREAMING_NONE)) {
+            continue;
+        }
+        auto& pool = pools[poolIdx];
+        if (offset + pool.layerSize > stagingSize) {
+            break;
+        }
+        uint32_t layer;
+        if (!acquireLayer(poolIdx, layer)) {
+            pool.unmet++;
+            continue;
+        }
+        pool.owners[layer] = texSlot;
+        uploads.push_back({ texSlot, poolIdx, layer, offset });
+        offset += pool.layerSize;
+    }
+    evictUnmet();
+    if (uploads.empty()) {
+        return;
+    }
+
+    auto& jobs = getJobSystem();
+    for (auto& upload: uploads) {
+        auto dst = mappedStaging + upload.offset;
+        auto& texels = *sources[upload.texSlot];
+        jobs.submit(fill, [dst, &texels]() {
+            memcpy(dst, texels.data(), texels.size());
+        });
+    }
+    state = STREAM_FILLING;
+}
+
+void TextureStreamer::submitBatch() {
+    cmd = beginOneShotCommandBuffer(vk);
+    for (auto& upload: uploads) {
+        auto& pool = pools[upload.pool];
+        recordTextureArrayLayerCopy(
+            cmd,
+            arrays[pool.arrayIdx],
+            upload.layer,
+            staging.handle,
+            upload.offset
+        );
+    }
+    VKCHECK(vkEndCommandBuffer(cmd));
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmd;
+    VKCHECK(vkQueueSubmit(vk.queue, 1, &submitInfo, fence));
+    state = STREAM_UPLOADING;
+}
+
+void TextureStreamer::retireBatch() {
+    if (vkGetFenceStatus(vk.device, fence) != VK_SUCCESS) {
+        return;
+    }
+    VKCHECK(vkResetFences(vk.device, 1, &fence));
+    vkFreeCommandBuffers(vk.device, vk.cmdPoolTransient, 1, &cmd);
+    cmd = VK_NULL_HANDLE;
+
+    for (auto& upload: uploads) {
+        auto& pool = pools[upload.pool];
+        streamedLayers[upload.texSlot] = upload.layer;
+        locationData[upload.texSlot] =
+            packTextureLocation(pool.arrayIdx, upload.layer);
+    }
+    uploads.clear();
+    state = STREAM_IDLE;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <vector>
+
+#include "BSPTextureParser.h"
+#include "JobSystem.h"
+#include "TexturePacker.h"
+#include "TextureRegistry.h"
+#include "UniformRing.h"
+#include "VulkanResources.h"
+
+using std::vector;
+
+// NOTE(jan): Set from the command line with -texturebudget <MiB>. Covers the
+// largest mip level only, the lower levels of every texture stay resident.
+extern uint32_t textureBudgetMiB;
+
+// NOTE(jan): Size classes smaller than this are kept fully resident.
+const uint32_t STREAMING_MIN_SIZE = 64;
+// NOTE(jan): Texels of the largest mip shrink below a pixel at around 540
+// units with a 90 degree field of view on a 1080 pixel high screen.
+const float STREAMING_DISTANCE = 768.f;
+const VkDeviceSize STREAMING_STAGING_SIZE = 4 * 1024 * 1024;
+const uint32_t STREAMING_NONE = 0xFFFFFFFF;
+
+enum STREAMSTATE {
+    STREAM_IDLE = 0,
+    // NOTE(jan): Jobs are copying texels into the staging buffer.
+    STREAM_FILLING,
+    // NOTE(jan): The transfer has been submitted and has not signalled yet.
+    STREAM_UPLOADING
+};
+
+// NOTE(jan): Largest mip level of a size class, for as many textures as the
+// budget allows.
+struct StreamingPool {
+    uint32_t arrayIdx;
+    VkDeviceSize layerSize;
+    // NOTE(jan): Texture slot held by each layer.
+    vector<uint32_t> owners;
+    // NOTE(jan): Evicted layers that frames in flight may still sample. They
+    // become free once drainFence signals.
+    vector<bool> draining;
+    // NOTE(jan): Requests in the current batch that found no free layer.
+    uint32_t unmet;
+};
+
+struct StreamingUpload {
+    uint32_t texSlot;
+    uint32_t pool;
+    uint32_t layer;
+    VkDeviceSize offset;
+};
+
+/* NOTE(jan): Every texture keeps mip levels 1 and below resident in the
+   texture registry, at half its size. The largest level is streamed into a
+   pool when a visible face close to the camera requests it, and evicted least
+   recently requested first. Shaders look up the current location of each slot
+   in a storage buffer, see textures.glsl, which is streamed through a ring
+   every frame since frames in flight read it. */
+struct TextureStreamer {
+    // NOTE(jan): Registry arrays followed by pools.
+    vector<VulkanTextureArray> arrays;
+    UniformRing locations;
+
+    TextureStreamer(
+        Vulkan& vk,
+        vector<Texture>& textures,
+        TexturePacker& packer,
+        vector<JobCounter>& decodes,
+        TextureTable& table
+    );
+    // NOTE(jan): The device must be idle.
+    ~TextureStreamer();
+
+    // NOTE(jan): Requests the largest mip of every frame of the animation.
+    void request(uint32_t texSlot);
+    // NOTE(jan): Call once per frame, after the requests for that frame.
+    void update();
+
+private:
+    Vulkan& vk;
+    vector<Texture>& textures;
+    TextureTable& table;
+    uint64_t frame;
+
+    // NOTE(jan): What locations streams, see update.
+    vector<uint32_t> locationData;
+    vector<uint32_t> residentLocations;
+    vector<uint32_t> texturePools;
+    vector<uint32_t> streamedLayers;
+    vector<uint64_t> lastRequested;
+    // NOTE(jan): Largest mip of each streamed texture, owned by the registry.
+    vector<vector<uint8_t>*> sources;
+    vector<StreamingPool> pools;
+
+    STREAMSTATE state;
+    vector<StreamingUpload> uploads;
+    VulkanBuffer staging;
+    VkDeviceSize stagingSize;
+    uint8_t* mappedStaging;
+    JobCounter fill;
+    VkCommandBuffer cmd;
+    VkFence fence;
+    // NOTE(jan): Signals once the frames submitted before the last evictions
+    // have finished. Only one drain is in flight at a time.
+    VkFence drainFence;
+    bool drainPending;
+
+    void touch(uint32_t texSlot);
+    bool acquireLayer(uint32_t pool, uint32_t& layer);
+    void evict(uint32_t pool, uint32_t layer);
+    void evictUnmet();
+    void retireDrain();
+    void beginBatch();
+    void submitBatch();
+    void retireBatch();
+};
@@ -0,0 +1,116 @@
+#include <cstring>
+
+#include "Presenter.h"
+#include "UniformRing.h"
+
+void UniformRing::init(
+    Vulkan& vk,
+    VkDeviceSize size,
+    VkBufferUsageFlags usage
+) {
+    this->size = size;
+    this->usage = usage;
+    stride = (size + UNIFORM_BLOCK_ALIGNMENT - 1) &
+        ~(UNIFORM_BLOCK_ALIGNMENT - 1);
+    auto imageCount = (VkDeviceSize)vk.swap.images.size();
+
+    createBuffer(
+        vk,
+        usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        stride * imageCount,
+        blocks
+    );
+    createBuffer(
+        vk,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        stride * imageCount,
+        staging
+    );
+    mapped = (uint8_t*)mapBufferMemory(
+        vk.device,
+        staging.handle,
+        staging.memory
+    );
+    memset(mapped, 0, stride * imageCount);
+}
+
+VkDeviceSize UniformRing::offset(uint32_t image) {
+    return image * stride;
+}
+
+void UniformRing::updateDescriptor(
+    VkDevice device,
+    VkDescriptorSet descriptorSet,
+    uint32_t binding,
+    uint32_t image
+) {
+    VkDescriptorBufferInfo info = {};
+    info.buffer = blocks.handle;
+    info.offset = offset(image);
+    info.range = size;
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptorSet;
+    write.dstBinding = binding;
+    write.descriptorCount = 1;
+    write.descriptorType = (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) ?
+        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER :
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &info;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+void UniformRing::recordCopy(VkCommandBuffer cmd, uint32_t image) {
+    // NOTE(jan): No barrier before the copy. The Presenter has already waited
+    // for the last frame that read this block.
+    VkBufferCopy region = {};
+    region.srcOffset = offset(image);
+    region.dstOffset = offset(image);
+    region.size = size;
+    vkCmdCopyBuffer(cmd, staging.handle, blocks.handle, 1, &region);
+
+    // NOTE(jan): Covers every way the pipelines read a ring, whatever its
+    // usage.
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT |
+        VK_ACCESS_SHADER_READ_BIT |
+        VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = blocks.handle;
+    barrier.offset = offset(image);
+    barrier.size = size;
+
+    vkCmdPipelineBarrier(
+        cmd,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+            VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        0,
+        0, nullptr,
+        1, &barrier,
+        0, nullptr
+    );
+}
+
+void UniformRing::push(const void* data) {
+    memcpy(mapped + offset(getPresenter().image), data, size);
+}
+
+void UniformRing::release(Vulkan& vk) {
+    unMapMemory(vk.device, staging.memory);
+    destroyBuffer(vk, staging);
+    destroyBuffer(vk, blocks);
+}
+
+UniformRing& getUniformRing() {
+    static UniformRing ring;
+    return ring;
+}
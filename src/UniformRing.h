@@ -0,0 +1,61 @@
+#pragma once
+
+#include "VulkanResources.h"
+
+// NOTE(jan): Covers minUniformBufferOffsetAlignment and
+// minStorageBufferOffsetAlignment, which the spec caps at 256.
+const VkDeviceSize UNIFORM_BLOCK_ALIGNMENT = 256;
+
+/* NOTE(jan): Replaces the single mapped uniform block, which the CPU wrote
+   while frames in flight read it. Every swap image has its own device-local
+   block, which only that image's command buffers read, and its own slice of
+   a mapped staging buffer. push writes the slice of the image the Presenter
+   acquired, and the image's command buffers copy it into the block before
+   anything reads it, see recordCopy. The Presenter waits for the last frame
+   that used an image before handing it out again, so neither is in use when
+   they are written, and frames on other images never wait for each other.
+
+   The pipelines' descriptor layouts come from SPIR-V reflection, which rules
+   out dynamic offsets, so each image binds its block through its own
+   descriptor set, see updateDescriptor.
+
+   Other small per-frame blocks stream the same way, with their own ring and
+   usage, see RenderText.cpp. */
+struct UniformRing {
+    // NOTE(jan): What the pipelines read, one block per image at offset().
+    // Only written by the copies recordCopy records.
+    VulkanBuffer blocks;
+    VkDeviceSize size;
+
+    void init(
+        Vulkan& vk,
+        VkDeviceSize size,
+        VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+    );
+    VkDeviceSize offset(uint32_t image);
+    // NOTE(jan): Points a descriptor at the image's block, as a uniform
+    // buffer when that is the ring's usage, and a storage buffer otherwise.
+    void updateDescriptor(
+        VkDevice device,
+        VkDescriptorSet descriptorSet,
+        uint32_t binding,
+        uint32_t image
+    );
+    // NOTE(jan): Records the copy of the image's slice into its block,
+    // followed by a barrier for everything that reads it. Outside a render
+    // pass, in the first of the image's command buffers that reads it.
+    void recordCopy(VkCommandBuffer cmd, uint32_t image);
+    // NOTE(jan): Call once per frame, after Presenter::acquire and before
+    // Presenter::present.
+    void push(const void* data);
+    // NOTE(jan): The device must be idle.
+    void release(Vulkan& vk);
+
+private:
+    VkDeviceSize stride;
+    VkBufferUsageFlags usage;
+    VulkanBuffer staging;
+    uint8_t* mapped;
+};
+
+UniformRing& getUniformRing();
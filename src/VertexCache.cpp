@@ -0,0 +1,330 @@
+#pragma warning(disable: 4267)
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "VertexCache.h"
+
+using std::vector;
+
+// NOTE(jan): Tuning from the paper. The optimiser models an LRU cache, which
+// also does well on FIFO caches of about the same size.
+const uint32_t FORSYTH_CACHE_SIZE = 32;
+const float FORSYTH_CACHE_DECAY = 1.5f;
+const float FORSYTH_LAST_TRIANGLE_SCORE = .75f;
+const float FORSYTH_VALENCE_SCALE = 2.f;
+const float FORSYTH_VALENCE_POWER = .5f;
+const uint32_t FORSYTH_NONE = 0xFFFFFFFF;
+
+float measureACMR(
+    const uint32_t* indices,
+    size_t indexCount,
+    uint32_t vertexCount,
+    uint32_t cacheSize
+) {
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0) {
+        return 0.f;
+    }
+    // NOTE(jan): A vertex is in the cache while fewer than cacheSize misses
+    // happened since its own, which is how a FIFO evicts.
+    vector<uint32_t> timestamps(vertexCount, 0);
+    uint32_t time = cacheSize + 1;
+    uint32_t misses = 0;
+    for (size_t i = 0; i < indexCount; i++) {
+        auto vertex = indices[i];
+        if (time - timestamps[vertex] > cacheSize) {
+            timestamps[vertex] = time++;
+            misses++;
+        }
+    }
+    return (float)misses / triangleCount;
+}
+
+static float forsythScore(int32_t cachePosition, uint32_t valence) {
+    if (valence == 0) {
+        return -1.f;
+    }
+    float score = 0.f;
+    if (cachePosition >= 0) {
+        // NOTE(jan): The last triangle's vertices score the same whatever
+        // their order, so triangles sharing an edge with it are not favoured
+        // over ones sharing a single vertex.
+        if (cachePosition < 3) {
+            score = FORSYTH_LAST_TRIANGLE_SCORE;
+        } else {
+            float scale = 1.f / (FORSYTH_CACHE_SIZE - 3);
+            score = powf(
+                1.f - (cachePosition - 3) * scale,
+                FORSYTH_CACHE_DECAY
+            );
+        }
+    }
+    // NOTE(jan): Vertices with few triangles left are finished off first, so
+    // they stop taking up space in the cache.
+    score += FORSYTH_VALENCE_SCALE *
+        powf((float)valence, -FORSYTH_VALENCE_POWER);
+    return score;
+}
+
+void optimizeVertexCache(
+    uint32_t* indices,
+    size_t indexCount,
+    uint32_t vertexCount
+) {
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount < 2) {
+        return;
+    }
+
+    // NOTE(jan): Triangles of each vertex that are still to be emitted, with
+    // emitted ones swapped past the end of the vertex's list.
+    vector<uint32_t> valences(vertexCount, 0);
+    for (size_t i = 0; i < indexCount; i++) {
+        valences[indices[i]]++;
+    }
+    vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (uint32_t vertex = 0; vertex < vertexCount; vertex++) {
+        offsets[vertex + 1] = offsets[vertex] + valences[vertex];
+    }
+    vector<uint32_t> adjacency(indexCount);
+    vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indexCount; i++) {
+        adjacency[fill[indices[i]]++] = i / 3;
+    }
+
+    vector<float> vertexScores(vertexCount);
+    for (uint32_t vertex = 0; vertex < vertexCount; vertex++) {
+        vertexScores[vertex] = forsythScore(-1, valences[vertex]);
+    }
+    uint32_t best = FORSYTH_NONE;
+    float bestScore = -1.f;
+    for (size_t triangle = 0; triangle < triangleCount; triangle++) {
+        auto corners = indices + triangle * 3;
+        auto score = vertexScores[corners[0]] +
+            vertexScores[corners[1]] +
+            vertexScores[corners[2]];
+        if (score > bestScore) {
+            bestScore = score;
+            best = triangle;
+        }
+    }
+
+    vector<bool> emitted(triangleCount, false);
+    vector<uint32_t> output(indexCount);
+    uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+    uint32_t cacheCount = 0;
+    uint32_t nextCache[FORSYTH_CACHE_SIZE + 3];
+    size_t cursor = 0;
+    for (size_t outTriangle = 0; outTriangle < triangleCount; outTriangle++) {
+        // NOTE(jan): Nothing in the cache has triangles left, so carry on in
+        // input order.
+        if (best == FORSYTH_NONE) {
+            while (emitted[cursor]) {
+                cursor++;
+            }
+            best = cursor;
+        }
+        auto corners = indices + best * 3;
+        memcpy(output.data() + outTriangle * 3, corners, 3 * sizeof(uint32_t));
+        emitted[best] = true;
+
+        uint32_t nextCount = 0;
+        for (uint32_t i = 0; i < 3; i++) {
+            auto vertex = corners[i];
+            auto first = adjacency.data() + offsets[vertex];
+            auto last = first + valences[vertex];
+            auto found = std::find(first, last, best);
+            if (found != last) {
+                std::swap(*found, *(last - 1));
+                valences[vertex]--;
+            }
+            if (std::find(nextCache, nextCache + nextCount, vertex) ==
+                    nextCache + nextCount) {
+                nextCache[nextCount++] = vertex;
+            }
+        }
+        for (uint32_t i = 0; i < cacheCount; i++) {
+            auto vertex = cache[i];
+            if ((vertex != corners[0]) &&
+                    (vertex != corners[1]) &&
+                    (vertex != corners[2])) {
+                nextCache[nextCount++] = vertex;
+            }
+        }
+
+        // NOTE(jan): Only triangles touching the cache change score, and the
+        // best of them is almost always the best overall.
+        for (uint32_t i = 0; i < nextCount; i++) {
+            auto vertex = nextCache[i];
+            int32_t position = i < FORSYTH_CACHE_SIZE ? (int32_t)i : -1;
+            vertexScores[vertex] = forsythScore(position, valences[vertex]);
+        }
+        best = FORSYTH_NONE;
+        bestScore = -1.f;
+        for (uint32_t i = 0; i < nextCount; i++) {
+            auto vertex = nextCache[i];
+            auto first = adjacency.data() + offsets[vertex];
+            for (uint32_t j = 0; j < valences[vertex]; j++) {
+                auto triangle = first[j];
+                auto triangleCorners = indices + triangle * 3;
+                auto score = vertexScores[triangleCorners[0]] +
+                    vertexScores[triangleCorners[1]] +
+                    vertexScores[triangleCorners[2]];
+                if (score > bestScore) {
+                    bestScore = score;
+                    best = triangle;
+                }
+            }
+        }
+
+        cacheCount = std::min(nextCount, FORSYTH_CACHE_SIZE);
+        memcpy(cache, nextCache, cacheCount * sizeof(uint32_t));
+    }
+    memcpy(indices, output.data(), indexCount * sizeof(uint32_t));
+}
+
+struct OverdrawRun {
+    size_t firstTriangle;
+    size_t triangleCount;
+    float key;
+};
+
+void optimizeOverdraw(
+    uint32_t* indices,
+    size_t indexCount,
+    const void* vertices,
+    size_t vertexStride,
+    uint32_t vertexCount
+) {
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount < 2) {
+        return;
+    }
+    auto position = [vertices, vertexStride](uint32_t vertex) {
+        return (const float*)((const uint8_t*)vertices + vertex * vertexStride);
+    };
+
+    // NOTE(jan): A triangle whose three vertices all miss starts over with a
+    // cold cache, so moving the run it starts costs next to nothing.
+    vector<OverdrawRun> runs;
+    vector<uint32_t> timestamps(vertexCount, 0);
+    uint32_t time = VERTEX_CACHE_SIZE + 1;
+    for (size_t triangle = 0; triangle < triangleCount; triangle++) {
+        uint32_t misses = 0;
+        for (uint32_t i = 0; i < 3; i++) {
+            auto vertex = indices[triangle * 3 + i];
+            if (time - timestamps[vertex] > VERTEX_CACHE_SIZE) {
+                timestamps[vertex] = time++;
+                misses++;
+            }
+        }
+        if (runs.empty() || (misses == 3)) {
+            runs.push_back({ triangle, 0, 0.f });
+        }
+        runs.back().triangleCount++;
+    }
+    if (runs.size() < 2) {
+        return;
+    }
+
+    // NOTE(jan): Area weighted centres and normals, with each triangle's
+    // normal as long as twice its area.
+    vector<float> centres(triangleCount * 3);
+    vector<float> normals(triangleCount * 3);
+    float meshCentre[3] = {};
+    float meshArea = 0.f;
+    for (size_t triangle = 0; triangle < triangleCount; triangle++) {
+        auto a = position(indices[triangle * 3]);
+        auto b = position(indices[triangle * 3 + 1]);
+        auto c = position(indices[triangle * 3 + 2]);
+        float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        float ac[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+        auto normal = normals.data() + triangle * 3;
+        normal[0] = ab[1] * ac[2] - ab[2] * ac[1];
+        normal[1] = ab[2] * ac[0] - ab[0] * ac[2];
+        normal[2] = ab[0] * ac[1] - ab[1] * ac[0];
+        float area = sqrtf(
+            normal[0] * normal[0] +
+            normal[1] * normal[1] +
+            normal[2] * normal[2]
+        );
+        auto centre = centres.data() + triangle * 3;
+        for (uint32_t i = 0; i < 3; i++) {
+            centre[i] = (a[i] + b[i] + c[i]) / 3.f;
+            meshCentre[i] += centre[i] * area;
+        }
+        meshArea += area;
+    }
+    if (meshArea == 0.f) {
+        return;
+    }
+    for (auto& coordinate: meshCentre) {
+        coordinate /= meshArea;
+    }
+
+    // NOTE(jan): Whichever winding the mesh uses, its normals point out of it
+    // on the whole, which for a closed mesh makes this sum its volume.
+    float orientation = 0.f;
+    for (size_t triangle = 0; triangle < triangleCount; triangle++) {
+        auto centre = centres.data() + triangle * 3;
+        auto normal = normals.data() + triangle * 3;
+        for (uint32_t i = 0; i < 3; i++) {
+            orientation += (centre[i] - meshCentre[i]) * normal[i];
+        }
+    }
+    orientation = orientation < 0.f ? -1.f : 1.f;
+
+    for (auto& run: runs) {
+        float runCentre[3] = {};
+        float runNormal[3] = {};
+        float runArea = 0.f;
+        for (size_t j = 0; j < run.triangleCount; j++) {
+            auto triangle = run.firstTriangle + j;
+            auto centre = centres.data() + triangle * 3;
+            auto normal = normals.data() + triangle * 3;
+            float area = sqrtf(
+                normal[0] * normal[0] +
+                normal[1] * normal[1] +
+                normal[2] * normal[2]
+            );
+            for (uint32_t i = 0; i < 3; i++) {
+                runCentre[i] += centre[i] * area;
+                runNormal[i] += normal[i];
+            }
+            runArea += area;
+        }
+        float normalLength = sqrtf(
+            runNormal[0] * runNormal[0] +
+            runNormal[1] * runNormal[1] +
+            runNormal[2] * runNormal[2]
+        );
+        if ((runArea == 0.f) || (normalLength == 0.f)) {
+            continue;
+        }
+        for (uint32_t i = 0; i < 3; i++) {
+            run.key += (runCentre[i] / runArea - meshCentre[i]) *
+                runNormal[i] / normalLength;
+        }
+        run.key *= orientation;
+    }
+
+    // NOTE(jan): Runs furthest out along their own normal are the likeliest
+    // to cover the rest of the mesh.
+    std::stable_sort(
+        runs.begin(),
+        runs.end(),
+        [](const OverdrawRun& a, const OverdrawRun& b) {
+            return a.key > b.key;
+        }
+    );
+    vector<uint32_t> output;
+    output.reserve(indexCount);
+    for (auto& run: runs) {
+        auto first = indices + run.firstTriangle * 3;
+        output.insert(output.end(), first, first + run.triangleCount * 3);
+    }
+    memcpy(indices, output.data(), indexCount * sizeof(uint32_t));
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+// NOTE(jan): Size of the FIFO cache measureACMR simulates. Recent GPUs reuse
+// vertices over roughly this many, although none of them document a FIFO.
+const uint32_t VERTEX_CACHE_SIZE = 32;
+
+// NOTE(jan): Average cache misses per triangle, between 3 for no reuse at all
+// and 0.5 for a large regular grid. Every vertex misses at least once, so a
+// mesh can never go below its vertex count over its triangle count.
+float measureACMR(
+    const uint32_t* indices,
+    size_t indexCount,
+    uint32_t vertexCount,
+    uint32_t cacheSize = VERTEX_CACHE_SIZE
+);
+
+// NOTE(jan): Reorders triangles for the post-transform vertex cache, see Tom
+// Forsyth's "Linear-Speed Vertex Cache Optimisation". Triangles keep their
+// winding, and the set of indices does not change.
+void optimizeVertexCache(
+    uint32_t* indices,
+    size_t indexCount,
+    uint32_t vertexCount
+);
+
+// NOTE(jan): Splits cache-optimised triangles into runs that start with a cold
+// cache, and draws the runs facing out from the middle of the mesh first, so
+// they cover what is behind them. Run after optimizeVertexCache. Positions are
+// three floats at the start of every vertex.
+void optimizeOverdraw(
+    uint32_t* indices,
+    size_t indexCount,
+    const void* vertices,
+    size_t vertexStride,
+    uint32_t vertexCount
+);
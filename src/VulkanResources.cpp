@@ -0,0 +1,523 @@
+#pragma warning(disable: 4267)
+
+#include "VulkanResources.h"
+
+uint32_t findMemoryTypeIndex(
+    VkPhysicalDeviceMemoryProperties& memories,
+    uint32_t typeBits,
+    VkMemoryPropertyFlags flags
+) {
+    for (uint32_t i = 0; i < memories.memoryTypeCount; i++) {
+        auto& type = memories.memoryTypes[i];
+        if ((typeBits & (1 << i)) && ((type.propertyFlags & flags) == flags)) {
+            return i;
+        }
+    }
+    throw runtime_error("could not find suitable memory type");
+}
+
+void createBuffer(
+    Vulkan& vk,
+    VkBufferUsageFlags usage,
+    VkMemoryPropertyFlags flags,
+    VkDeviceSize size,
+    VulkanBuffer& buffer
+) {
+    buffer = {};
+
+    VkBufferCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    createInfo.size = size;
+    createInfo.usage = usage;
+    createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    createInfo.queueFamilyIndexCount = 1;
+    createInfo.pQueueFamilyIndices = &vk.queueFamily;
+    VKCHECK(vkCreateBuffer(vk.device, &createInfo, nullptr, &buffer.handle));
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(vk.device, buffer.handle, &requirements);
+
+    VkMemoryAllocateInfo allocateInfo = {};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocateInfo.allocationSize = requirements.size;
+    allocateInfo.memoryTypeIndex = findMemoryTypeIndex(
+        vk.memories,
+        requirements.memoryTypeBits,
+        flags
+    );
+    VKCHECK(vkAllocateMemory(vk.device, &allocateInfo, nullptr, &buffer.memory));
+    VKCHECK(vkBindBufferMemory(vk.device, buffer.handle, buffer.memory, 0));
+}
+
+void destroyBuffer(
+    Vulkan& vk,
+    VulkanBuffer& buffer
+) {
+    vkDestroyBuffer(vk.device, buffer.handle, nullptr);
+    vkFreeMemory(vk.device, buffer.memory, nullptr);
+    buffer = {};
+}
+
+void destroyMesh(
+    Vulkan& vk,
+    VulkanMesh& mesh
+) {
+    vkDestroyBufferView(vk.device, mesh.vBuff.view, nullptr);
+    destroyBuffer(vk, mesh.vBuff);
+    vkDestroyBufferView(vk.device, mesh.iBuff.view, nullptr);
+    destroyBuffer(vk, mesh.iBuff);
+}
+
+void uploadStorageBuffer(
+    Vulkan& vk,
+    void* data,
+    VkDeviceSize size,
+    VulkanBuffer& buffer
+) {
+    // NOTE(jan): Zero sized buffers are not allowed, but empty tables are.
+    VkDeviceSize allocationSize = size > 0 ? size : 16;
+    createBuffer(
+        vk,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        allocationSize,
+        buffer
+    );
+    if (size > 0) {
+        void* dst = mapBufferMemory(vk.device, buffer.handle, buffer.memory);
+            memcpy(dst, data, size);
+        unMapMemory(vk.device, buffer.memory);
+    }
+}
+
+void updateStorageBuffer(
+    VkDevice device,
+    VkDescriptorSet descriptorSet,
+    uint32_t binding,
+    VulkanBuffer& buffer
+) {
+    VkDescriptorBufferInfo bufferInfo = {};
+    bufferInfo.buffer = buffer.handle;
+    bufferInfo.offset = 0;
+    bufferInfo.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptorSet;
+    write.dstBinding = binding;
+    write.dstArrayElement = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &bufferInfo;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+VkCommandBuffer beginOneShotCommandBuffer(Vulkan& vk) {
+    VkCommandBuffer cmd;
+    createCommandBuffers(vk.device, vk.cmdPoolTransient, 1, &cmd);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VKCHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+
+    return cmd;
+}
+
+void endOneShotCommandBuffer(Vulkan& vk, VkCommandBuffer cmd) {
+    VKCHECK(vkEndCommandBuffer(cmd));
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmd;
+    VKCHECK(vkQueueSubmit(vk.queue, 1, &submitInfo, VK_NULL_HANDLE));
+    VKCHECK(vkQueueWaitIdle(vk.queue));
+
+    vkFreeCommandBuffers(vk.device, vk.cmdPoolTransient, 1, &cmd);
+}
+
+void transitionTextureArrayLayers(
+    VkCommandBuffer cmd,
+    VulkanTextureArray& array,
+    uint32_t firstLayer,
+    uint32_t layerCount,
+    VkImageLayout oldLayout,
+    VkImageLayout newLayout,
+    VkAccessFlags srcAccess,
+    VkAccessFlags dstAccess,
+    VkPipelineStageFlags srcStage,
+    VkPipelineStageFlags dstStage
+) {
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = array.image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = array.mipLevels;
+    barrier.subresourceRange.baseArrayLayer = firstLayer;
+    barrier.subresourceRange.layerCount = layerCount;
+
+    vkCmdPipelineBarrier(
+        cmd,
+        srcStage, dstStage,
+        0,
+        0, nullptr,
+        0, nullptr,
+        1, &barrier
+    );
+}
+
+VkFormat toVkFormat(TEXFORMAT format) {
+    switch (format) {
+        case TEXFORMAT::BC1:
+            return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+        case TEXFORMAT::BC3:
+            return VK_FORMAT_BC3_UNORM_BLOCK;
+        case TEXFORMAT::R8:
+            return VK_FORMAT_R8_UNORM;
+        default:
+            return VK_FORMAT_R8G8B8A8_UNORM;
+    }
+}
+
+bool supportsBlockCompression(Vulkan& vk) {
+    // NOTE(jan): The feature guarantees every BC format, but a device can
+    // also support some of them without it.
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(vk.gpu, &features);
+    if (features.textureCompressionBC) {
+        return true;
+    }
+    VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    for (auto format: { TEXFORMAT::BC1, TEXFORMAT::BC3 }) {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(
+            vk.gpu,
+            toVkFormat(format),
+            &properties
+        );
+        if ((properties.optimalTilingFeatures & required) != required) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void createTextureArray(
+    Vulkan& vk,
+    TEXFORMAT format,
+    uint32_t width,
+    uint32_t height,
+    uint32_t mipLevels,
+    uint32_t layers,
+    VulkanTextureArray& array
+) {
+    array = {};
+    array.format = format;
+    array.width = width;
+    array.height = height;
+    array.mipLevels = mipLevels;
+    array.layers = layers;
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = toVkFormat(format);
+    imageInfo.extent = { width, height, 1 };
+    imageInfo.mipLevels = mipLevels;
+    imageInfo.arrayLayers = layers;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+        VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VKCHECK(vkCreateImage(vk.device, &imageInfo, nullptr, &array.image));
+
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(vk.device, array.image, &requirements);
+
+    VkMemoryAllocateInfo allocateInfo = {};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocateInfo.allocationSize = requirements.size;
+    allocateInfo.memoryTypeIndex = findMemoryTypeIndex(
+        vk.memories,
+        requirements.memoryTypeBits,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+    );
+    VKCHECK(vkAllocateMemory(vk.device, &allocateInfo, nullptr, &array.memory));
+    VKCHECK(vkBindImageMemory(vk.device, array.image, array.memory, 0));
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = array.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewInfo.format = toVkFormat(format);
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = mipLevels;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = layers;
+    VKCHECK(vkCreateImageView(vk.device, &viewInfo, nullptr, &array.view));
+
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.maxLod = (float)(mipLevels - 1);
+    VKCHECK(vkCreateSampler(vk.device, &samplerInfo, nullptr, &array.sampler));
+
+    // NOTE(jan): Keep every layer in a sampleable layout so that later
+    // uploads can replace individual layers without discarding the rest.
+    auto cmd = beginOneShotCommandBuffer(vk);
+    transitionTextureArrayLayers(
+        cmd, array, 0, layers,
+        VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        0, VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+    );
+    endOneShotCommandBuffer(vk, cmd);
+}
+
+void destroyTextureArray(
+    Vulkan& vk,
+    VulkanTextureArray& array
+) {
+    vkDestroySampler(vk.device, array.sampler, nullptr);
+    vkDestroyImageView(vk.device, array.view, nullptr);
+    vkDestroyImage(vk.device, array.image, nullptr);
+    vkFreeMemory(vk.device, array.memory, nullptr);
+    array = {};
+}
+
+void uploadTextureArrayLayers(
+    Vulkan& vk,
+    VulkanTextureArray& array,
+    uint32_t firstLayer,
+    uint32_t layerCount,
+    void* data,
+    VkDeviceSize size
+) {
+    VulkanBuffer staging;
+    createBuffer(
+        vk,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        size,
+        staging
+    );
+    void* dst = mapBufferMemory(vk.device, staging.handle, staging.memory);
+        memcpy(dst, data, size);
+    unMapMemory(vk.device, staging.memory);
+
+    auto cmd = beginOneShotCommandBuffer(vk);
+    transitionTextureArrayLayers(
+        cmd, array, firstLayer, layerCount,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT
+    );
+
+    vector<VkBufferImageCopy> regions(array.mipLevels);
+    VkDeviceSize offset = 0;
+    for (uint32_t level = 0; level < array.mipLevels; level++) {
+        auto width = array.width >> level;
+        auto height = array.height >> level;
+
+        auto& region = regions[level];
+        region = {};
+        region.bufferOffset = offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = level;
+        region.imageSubresource.baseArrayLayer = firstLayer;
+        region.imageSubresource.layerCount = layerCount;
+        region.imageExtent = { width, height, 1 };
+
+        offset += (VkDeviceSize)layerCount * mipByteSize(
+            array.format,
+            array.width,
+            array.height,
+            level
+        );
+    }
+    vkCmdCopyBufferToImage(
+        cmd,
+        staging.handle,
+        array.image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        (uint32_t)regions.size(), regions.data()
+    );
+
+    transitionTextureArrayLayers(
+        cmd, array, firstLayer, layerCount,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+    );
+    endOneShotCommandBuffer(vk, cmd);
+
+    destroyBuffer(vk, staging);
+}
+
+void recordTextureArrayLayerCopy(
+    VkCommandBuffer cmd,
+    VulkanTextureArray& array,
+    uint32_t layer,
+    VkBuffer buffer,
+    VkDeviceSize offset
+) {
+    transitionTextureArrayLayers(
+        cmd, array, layer, 1,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT
+    );
+
+    vector<VkBufferImageCopy> regions(array.mipLevels);
+    for (uint32_t level = 0; level < array.mipLevels; level++) {
+        auto& region = regions[level];
+        region = {};
+        region.bufferOffset = offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = level;
+        region.imageSubresource.baseArrayLayer = layer;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = {
+            array.width >> level,
+            array.height >> level,
+            1
+        };
+
+        offset += mipByteSize(array.format, array.width, array.height, level);
+    }
+    vkCmdCopyBufferToImage(
+        cmd,
+        buffer,
+        array.image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        (uint32_t)regions.size(), regions.data()
+    );
+
+    transitionTextureArrayLayers(
+        cmd, array, layer, 1,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+    );
+}
+
+void recordTextureArrayRegionCopies(
+    VkCommandBuffer cmd,
+    VulkanTextureArray& array,
+    uint32_t layer,
+    VkBuffer buffer,
+    vector<VkBufferImageCopy>& regions
+) {
+    transitionTextureArrayLayers(
+        cmd, array, layer, 1,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT
+    );
+    vkCmdCopyBufferToImage(
+        cmd,
+        buffer,
+        array.image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        (uint32_t)regions.size(), regions.data()
+    );
+    transitionTextureArrayLayers(
+        cmd, array, layer, 1,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+    );
+}
+
+void updateCombinedImageSamplerArrays(
+    VkDevice device,
+    VkDescriptorSet descriptorSet,
+    uint32_t binding,
+    vector<VulkanTextureArray>& arrays
+) {
+    if (arrays.size() > MAX_TEXTURE_ARRAYS) {
+        throw runtime_error("too many texture arrays");
+    }
+
+    vector<VkDescriptorImageInfo> imageInfos(arrays.size());
+    for (size_t i = 0; i < arrays.size(); i++) {
+        auto& imageInfo = imageInfos[i];
+        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        imageInfo.imageView = arrays[i].view;
+        imageInfo.sampler = arrays[i].sampler;
+    }
+
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptorSet;
+    write.dstBinding = binding;
+    write.dstArrayElement = 0;
+    write.descriptorCount = (uint32_t)imageInfos.size();
+    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write.pImageInfo = imageInfos.data();
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+}
+
+VkIndexType uploadIndices(
+    Vulkan& vk,
+    vector<uint32_t>& indices,
+    uint32_t vertexCount,
+    VulkanMesh& mesh
+) {
+    mesh.idxCount = indices.size();
+    if (indices.empty()) {
+        return VK_INDEX_TYPE_UINT32;
+    }
+
+    bool narrow = vertexCount <= UINT16_MAX;
+    uint32_t size = indices.size() *
+        (narrow ? sizeof(uint16_t) : sizeof(uint32_t));
+    createIndexBuffer(
+        vk.device, vk.memories, vk.queueFamily, size, mesh.iBuff
+    );
+    void *dst = mapBufferMemory(vk.device, mesh.iBuff.handle, mesh.iBuff.memory);
+    if (narrow) {
+        auto narrowed = (uint16_t*)dst;
+        for (size_t i = 0; i < indices.size(); i++) {
+            narrowed[i] = (uint16_t)indices[i];
+        }
+    } else {
+        memcpy(dst, indices.data(), size);
+    }
+    unMapMemory(vk.device, mesh.iBuff.memory);
+
+    return narrow ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
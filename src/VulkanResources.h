@@ -0,0 +1,132 @@
+#pragma once
+
+#include <vector>
+
+#include "BlockCompression.h"
+#include "Vulkan.h"
+
+using std::vector;
+
+// NOTE(jan): Keep in sync with the sampler2DArray declarations in the shaders.
+const uint32_t MAX_TEXTURE_ARRAYS = 32;
+
+struct VulkanTextureArray {
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+    VkSampler sampler;
+    TEXFORMAT format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    uint32_t layers;
+};
+
+uint32_t findMemoryTypeIndex(
+    VkPhysicalDeviceMemoryProperties& memories,
+    uint32_t typeBits,
+    VkMemoryPropertyFlags flags
+);
+
+void createBuffer(
+    Vulkan& vk,
+    VkBufferUsageFlags usage,
+    VkMemoryPropertyFlags flags,
+    VkDeviceSize size,
+    VulkanBuffer& buffer
+);
+
+void destroyBuffer(
+    Vulkan& vk,
+    VulkanBuffer& buffer
+);
+
+// NOTE(jan): Frees the buffers of uploadMesh and uploadIndices.
+void destroyMesh(
+    Vulkan& vk,
+    VulkanMesh& mesh
+);
+
+void uploadStorageBuffer(
+    Vulkan& vk,
+    void* data,
+    VkDeviceSize size,
+    VulkanBuffer& buffer
+);
+
+// NOTE(jan): Uses 16-bit indices when every vertex can be reached with them.
+VkIndexType uploadIndices(
+    Vulkan& vk,
+    vector<uint32_t>& indices,
+    uint32_t vertexCount,
+    VulkanMesh& mesh
+);
+
+void updateStorageBuffer(
+    VkDevice device,
+    VkDescriptorSet descriptorSet,
+    uint32_t binding,
+    VulkanBuffer& buffer
+);
+
+VkCommandBuffer beginOneShotCommandBuffer(Vulkan& vk);
+
+void endOneShotCommandBuffer(Vulkan& vk, VkCommandBuffer cmd);
+
+VkFormat toVkFormat(TEXFORMAT format);
+
+// NOTE(jan): Whether BC1 and BC3 images can be sampled with filtering.
+bool supportsBlockCompression(Vulkan& vk);
+
+void createTextureArray(
+    Vulkan& vk,
+    TEXFORMAT format,
+    uint32_t width,
+    uint32_t height,
+    uint32_t mipLevels,
+    uint32_t layers,
+    VulkanTextureArray& array
+);
+
+void destroyTextureArray(
+    Vulkan& vk,
+    VulkanTextureArray& array
+);
+
+// NOTE(jan): Data holds every mip level of the layers, largest level first,
+// with the layers of a level stored next to each other.
+void uploadTextureArrayLayers(
+    Vulkan& vk,
+    VulkanTextureArray& array,
+    uint32_t firstLayer,
+    uint32_t layerCount,
+    void* data,
+    VkDeviceSize size
+);
+
+// NOTE(jan): Records the copy of every mip level of a single layer, largest
+// level first. The buffer must outlive the command buffer.
+void recordTextureArrayLayerCopy(
+    VkCommandBuffer cmd,
+    VulkanTextureArray& array,
+    uint32_t layer,
+    VkBuffer buffer,
+    VkDeviceSize offset
+);
+
+// NOTE(jan): Records copies into parts of a single layer, leaving the rest of
+// it intact. The buffer must outlive the command buffer.
+void recordTextureArrayRegionCopies(
+    VkCommandBuffer cmd,
+    VulkanTextureArray& array,
+    uint32_t layer,
+    VkBuffer buffer,
+    vector<VkBufferImageCopy>& regions
+);
+
+void updateCombinedImageSamplerArrays(
+    VkDevice device,
+    VkDescriptorSet descriptorSet,
+    uint32_t binding,
+    vector<VulkanTextureArray>& arrays
+);
@@ -3,24 +3,41 @@
 
 #include <iomanip>
 
+// NOTE(jan): Keeps Windows.h from defining min and max macros, which break
+// std::min, std::max and their glm counterparts.
+#define NOMINMAX
 #include <Windows.h>
 
 #include "Logging.h"
 #include "FileSystem.cpp"
 #include "Vulkan.cpp"
 
+#include "Arena.cpp"
+#include "BlockCompression.cpp"
 #include "BSPParser.cpp"
 #include "BSPTextureParser.cpp"
 #include "Camera.cpp"
 #include "Controller.cpp"
+#include "CookedCache.cpp"
 #include "DirectInput.cpp"
+#include "Frustum.cpp"
+#include "JobSystem.cpp"
+#include "LightCompositor.cpp"
 #include "Mesh.cpp"
 #include "Mouse.cpp"
 #include "Palette.cpp"
 #include "PAKParser.cpp"
+#include "Presenter.cpp"
 #include "RenderLevel.cpp"
 #include "RenderModel.cpp"
 #include "RenderText.cpp"
+#include "SurfaceCache.cpp"
+#include "TexturePacker.cpp"
+#include "TextureRegistry.cpp"
+#include "TextureStreamer.cpp"
+#include "UniformRing.cpp"
+#include "VertexCache.cpp"
+#include "VulkanResources.cpp"
 #include "Win32.cpp"
 
 using std::exception;
@@ -37,6 +54,7 @@ struct Uniforms {
     float elapsedS;
     // NOTE(jan): GLSL pads array elements to align on 4 byte boundaries
     float light[4*12];
+    uint32_t textureFrame;
 };
 #pragma pack (pop)
 
@@ -50,6 +68,21 @@ const float JOYSTICK_SENSITIVITY = 100;
 
 bool keyboard[VK_OEM_CLEAR] = {};
 
+// NOTE(jan): Cycled through with N. Consecutive maps share most of their
+// textures, see TextureRegistry.h.
+const char* MAP_ROTATION[] = {
+    "start",
+    "e1m1",
+    "e1m2",
+    "e1m3",
+    "e1m4",
+    "e1m5",
+    "e1m6",
+    "e1m7",
+    "e1m8"
+};
+const int MAP_ROTATION_COUNT = sizeof(MAP_ROTATION) / sizeof(MAP_ROTATION[0]);
+
 VkSurfaceKHR getSurface(
     HWND window,
     HINSTANCE instance,
@@ -149,13 +182,31 @@ MainLoop(
 
     Win32 platform(instance, window);
 
+    compressTextures = strstr(commandLine, "-compress") != nullptr;
+    auto budgetArg = strstr(commandLine, "-texturebudget ");
+    if (budgetArg) {
+        textureBudgetMiB = atoi(budgetArg + strlen("-texturebudget "));
+    }
+    surfaceCacheEnabled = strstr(commandLine, "-surfacecache") != nullptr;
+    auto surfaceBudgetArg = strstr(commandLine, "-surfacebudget ");
+    if (surfaceBudgetArg) {
+        surfaceBudgetMiB = atoi(surfaceBudgetArg + strlen("-surfacebudget "));
+    }
+
     Vulkan vk;
     vk.extensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
     createVKInstance(vk);
     vk.swap.surface = getSurface(window, instance, vk.handle);
     initVK(vk);
+    getPresenter().init(vk);
+    getUniformRing().init(vk, sizeof(Uniforms));
+    if (compressTextures && !supportsBlockCompression(vk)) {
+        INFO("BC1 and BC3 are not supported, textures stay uncompressed");
+        compressTextures = false;
+    }
 
-    BSPParser* map = parser.loadMap("start");
+    int mapIdx = 0;
+    BSPParser* map = parser.loadMap(MAP_ROTATION[mapIdx]);
 
     auto playerStart = map->findEntityByName("info_player_start");
     auto origin = playerStart.origin;
@@ -200,8 +251,12 @@ MainLoop(
     vector<VkCommandBuffer> levelCmds;
     renderLevel(vk, *map, levelCmds);
     initModels(vk, parser, map->entities);
+    logCompressionStats();
     vector<VkCommandBuffer> modelCmds;
+    recordModelCommandBuffers(vk, modelCmds);
+    initText(vk);
     vector<VkCommandBuffer> textCmds;
+    recordTextCommandBuffers(vk, textCmds);
 
     DirectInput directInput(instance);
     Controller* controller = directInput.controller;
@@ -240,7 +295,8 @@ MainLoop(
             char debugString[1024];
             snprintf(debugString, 1024, "%.2f FPS", fps);
 
-            recordTextCommandBuffers(vk, textCmds, debugString);
+            getPresenter().acquire(vk);
+            updateText(vk, debugString);
 
             QueryPerformanceCounter(&frameStart);
                 Uniforms uniforms = {};
@@ -248,18 +304,20 @@ MainLoop(
                 uniforms.origin = camera.eye;
                 uniforms.elapsedS = (frameStart.QuadPart - epoch.QuadPart) /
                     (float)counterFrequency.QuadPart;
+                uniforms.textureFrame = textureAnimationFrame(uniforms.elapsedS);
 
                 int lightFrame = (int)(uniforms.elapsedS / .1f);
-                for (int i = 0; i < 12; i++) {
+                float lightValues[LIGHT_STYLE_COUNT];
+                for (int i = 0; i < LIGHT_STYLE_COUNT; i++) {
                     auto& lightstyle = lightstyles[i];
                     int lightStyleFrame = lightFrame % lightstyle.size();
-                    uniforms.light[i*4] = (lightstyle[lightStyleFrame] - 'a') / (float)('z' - 'a');
+                    lightValues[i] = (lightstyle[lightStyleFrame] - 'a') / (float)('z' - 'a');
+                    uniforms.light[i*4] = lightValues[i];
                 }
-                updateUniforms(vk, &uniforms, sizeof(uniforms));
+                getUniformRing().push(&uniforms);
+                updateLevel(vk, camera, lightValues, uniforms.elapsedS);
 
-                recordModelCommandBuffers(
-                    vk, uniforms.elapsedS, modelCmds
-                );
+                updateModels(vk, camera, uniforms.elapsedS);
                 vector<VkCommandBuffer> cmdss;
                 auto frameBufferCount = vk.swap.framebuffers.size();
                 for (unsigned i = 0; i < frameBufferCount; i++) {
@@ -267,14 +325,7 @@ MainLoop(
                     cmdss.push_back(modelCmds[i]);
                     cmdss.push_back(textCmds[i]);
                 }
-                present(vk, cmdss.data(), 3);
-                resetTextCommandBuffers(vk, textCmds);
-                vkFreeCommandBuffers(
-                    vk.device,
-                    vk.cmdPoolTransient,
-                    modelCmds.size(),
-                    modelCmds.data()
-                );
+                getPresenter().present(vk, cmdss.data(), 3);
             QueryPerformanceCounter(&frameEnd);
             // SetWindowText(window, buffer);
             frameDelta = frameEnd.QuadPart - frameStart.QuadPart;
@@ -305,6 +356,41 @@ MainLoop(
                     SWP_FRAMECHANGED
                 );
             }
+            if (keyboard['N']) {
+                keyboard['N'] = false;
+                mapIdx = (mapIdx + 1) % MAP_ROTATION_COUNT;
+                INFO("loading %s", MAP_ROTATION[mapIdx]);
+
+                VKCHECK(vkDeviceWaitIdle(vk.device));
+                vkFreeCommandBuffers(
+                    vk.device,
+                    vk.cmdPool,
+                    levelCmds.size(),
+                    levelCmds.data()
+                );
+                vkFreeCommandBuffers(
+                    vk.device,
+                    vk.cmdPool,
+                    modelCmds.size(),
+                    modelCmds.data()
+                );
+                auto nextMap = parser.loadMap(MAP_ROTATION[mapIdx]);
+                renderLevel(vk, *nextMap, levelCmds);
+                releaseModels(vk);
+                initModels(vk, parser, nextMap->entities);
+                recordModelCommandBuffers(vk, modelCmds);
+                delete map;
+                map = nextMap;
+
+                playerStart = map->findEntityByName("info_player_start");
+                origin = playerStart.origin;
+                angle = (float)-playerStart.angle;
+                camera.eye = { origin.x, origin.y, origin.z };
+                camera.at = camera.eye;
+                camera.at.x += 1;
+                camera.up = { 0, 1, 0 };
+                camera.rotateY(angle);
+            }
             if (keyboard['R']) {
                 camera.eye = { origin.x, origin.y, origin.z };
                 camera.at = camera.eye;
@@ -0,0 +1,180 @@
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "BlockCompression.h"
+
+using std::vector;
+
+// NOTE(jan): Checks the BC1 and BC3 encoders on the CPU, without a window or a
+// device. Fails if quality drops under the thresholds below, and reports how
+// long encoding takes.
+
+// NOTE(jan): A little under what the encoder reaches, so that regressions show
+// up without failing on rounding differences between compilers.
+const float MIN_GRADIENT_PSNR = 44.f;
+const float MIN_NOISE_PSNR = 14.f;
+const float MIN_SMALL_PSNR = 21.f;
+const uint32_t BENCH_SIZE = 1024;
+const uint32_t BENCH_RUNS = 4;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        printf("FAIL: %s\n", message);
+        failures++;
+    }
+}
+
+static uint32_t nextRandom(uint32_t& state) {
+    state = state * 1664525 + 1013904223;
+    return state >> 8;
+}
+
+static vector<uint8_t> makeGradient(uint32_t width, uint32_t height) {
+    vector<uint8_t> rgba(width * height * 4);
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            auto texel = rgba.data() + (y * width + x) * 4;
+            texel[0] = (uint8_t)(x * 255 / (width - 1));
+            texel[1] = (uint8_t)(y * 255 / (height - 1));
+            texel[2] = (uint8_t)((x + y) * 255 / (width + height - 2));
+            texel[3] = 255;
+        }
+    }
+    return rgba;
+}
+
+// NOTE(jan): Sixteen colours picked at random for every texel, which is about
+// as bad as a block can get with four colours to choose from.
+static vector<uint8_t> makeNoise(uint32_t width, uint32_t height) {
+    uint8_t palette[16][3];
+    uint32_t state = 1;
+    for (auto& color: palette) {
+        for (auto& channel: color) {
+            channel = (uint8_t)nextRandom(state);
+        }
+    }
+    vector<uint8_t> rgba(width * height * 4);
+    for (uint32_t i = 0; i < width * height; i++) {
+        auto& color = palette[nextRandom(state) % 16];
+        rgba[i*4] = color[0];
+        rgba[i*4+1] = color[1];
+        rgba[i*4+2] = color[2];
+        rgba[i*4+3] = 255;
+    }
+    return rgba;
+}
+
+static float roundTrip(
+    TEXFORMAT format,
+    const vector<uint8_t>& rgba,
+    uint32_t width,
+    uint32_t height,
+    vector<uint8_t>& decompressed
+) {
+    vector<uint8_t> blocks(mipByteSize(format, width, height, 0));
+    compressImage(format, rgba.data(), width, height, blocks.data());
+    decompressed.resize(width * height * 4);
+    decompressImage(format, blocks.data(), width, height, decompressed.data());
+    return computePSNR(rgba.data(), decompressed.data(), width * height);
+}
+
+static void testGradient() {
+    uint32_t width = 256;
+    uint32_t height = 256;
+    auto rgba = makeGradient(width, height);
+    vector<uint8_t> decompressed;
+    for (auto format: { TEXFORMAT::BC1, TEXFORMAT::BC3 }) {
+        auto psnr = roundTrip(format, rgba, width, height, decompressed);
+        printf(
+            "gradient BC%d: %.2fdB\n",
+            format == TEXFORMAT::BC1 ? 1 : 3,
+            psnr
+        );
+        check(psnr >= MIN_GRADIENT_PSNR, "gradient PSNR too low");
+    }
+}
+
+static void testNoise() {
+    uint32_t width = 64;
+    uint32_t height = 64;
+    auto rgba = makeNoise(width, height);
+    vector<uint8_t> decompressed;
+    auto psnr = roundTrip(TEXFORMAT::BC1, rgba, width, height, decompressed);
+    printf("noise BC1: %.2fdB\n", psnr);
+    check(psnr >= MIN_NOISE_PSNR, "noise PSNR too low");
+}
+
+// NOTE(jan): The fullbright mask is either 0 or 255, which BC3 must keep
+// exactly, see Palette::expand.
+static void testFullbrightMask() {
+    uint32_t width = 64;
+    uint32_t height = 64;
+    auto rgba = makeGradient(width, height);
+    uint32_t state = 7;
+    for (uint32_t i = 0; i < width * height; i++) {
+        rgba[i*4+3] = nextRandom(state) % 5 == 0 ? 0 : 255;
+    }
+    vector<uint8_t> decompressed;
+    roundTrip(TEXFORMAT::BC3, rgba, width, height, decompressed);
+    bool exact = true;
+    for (uint32_t i = 0; i < width * height; i++) {
+        exact = exact && (rgba[i*4+3] == decompressed[i*4+3]);
+    }
+    check(exact, "BC3 changed the fullbright mask");
+}
+
+// NOTE(jan): Partial blocks at the right and bottom edges.
+static void testOddSize() {
+    uint32_t width = 6;
+    uint32_t height = 10;
+    auto rgba = makeGradient(width, height);
+    vector<uint8_t> decompressed;
+    auto psnr = roundTrip(TEXFORMAT::BC1, rgba, width, height, decompressed);
+    printf("6x10 BC1: %.2fdB\n", psnr);
+    check(psnr >= MIN_SMALL_PSNR, "partial block PSNR too low");
+}
+
+static void benchEncode() {
+    auto rgba = makeNoise(BENCH_SIZE, BENCH_SIZE);
+    for (auto format: { TEXFORMAT::BC1, TEXFORMAT::BC3 }) {
+        vector<uint8_t> blocks(mipByteSize(format, BENCH_SIZE, BENCH_SIZE, 0));
+        auto start = std::chrono::high_resolution_clock::now();
+        for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+            compressImage(
+                format,
+                rgba.data(),
+                BENCH_SIZE,
+                BENCH_SIZE,
+                blocks.data()
+            );
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        auto seconds = std::chrono::duration<double>(end - start).count();
+        auto megatexels = (double)BENCH_SIZE * BENCH_SIZE * BENCH_RUNS / 1e6;
+        printf(
+            "encode BC%d: %.2fms per %dx%d, %.1f megatexels/s\n",
+            format == TEXFORMAT::BC1 ? 1 : 3,
+            seconds * 1000 / BENCH_RUNS,
+            BENCH_SIZE,
+            BENCH_SIZE,
+            megatexels / seconds
+        );
+    }
+}
+
+int main() {
+    testGradient();
+    testNoise();
+    testFullbrightMask();
+    testOddSize();
+    benchEncode();
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
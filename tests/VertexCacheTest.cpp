@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <vector>
+
+#include "VertexCache.h"
+
+using std::array;
+using std::vector;
+
+// NOTE(jan): Checks the vertex cache and overdraw optimisers on a grid, without
+// a window or a device. Fails if the optimised order misses the cache more
+// than the thresholds below, or if any triangle changes.
+
+const uint32_t GRID_SIZE = 64;
+// NOTE(jan): Shuffled triangles share almost no vertices with the ones
+// before them, so they start close to 3.
+const float MIN_SHUFFLED_ACMR = 2.5f;
+// NOTE(jan): A little over what the optimiser reaches, so that regressions
+// show up without failing on small changes in the scoring.
+const float MAX_OPTIMISED_ACMR = .75f;
+const float MAX_OVERDRAW_ACMR = .8f;
+
+static int failures = 0;
+
+static void check(bool condition, const char* message) {
+    if (!condition) {
+        printf("FAIL: %s\n", message);
+        failures++;
+    }
+}
+
+static uint32_t nextRandom(uint32_t& state) {
+    state = state * 1664525 + 1013904223;
+    return state >> 8;
+}
+
+// NOTE(jan): GRID_SIZE by GRID_SIZE quads of two triangles each, in a random
+// order.
+static vector<uint32_t> makeShuffledGrid() {
+    auto row = GRID_SIZE + 1;
+    vector<uint32_t> indices;
+    for (uint32_t y = 0; y < GRID_SIZE; y++) {
+        for (uint32_t x = 0; x < GRID_SIZE; x++) {
+            auto corner = y * row + x;
+            for (auto index: {
+                corner, corner + row, corner + 1,
+                corner + 1, corner + row, corner + row + 1
+            }) {
+                indices.push_back(index);
+            }
+        }
+    }
+    uint32_t state = 3;
+    auto triangleCount = indices.size() / 3;
+    for (size_t i = triangleCount - 1; i > 0; i--) {
+        auto j = nextRandom(state) % (i + 1);
+        for (uint32_t k = 0; k < 3; k++) {
+            std::swap(indices[i*3+k], indices[j*3+k]);
+        }
+    }
+    return indices;
+}
+
+static vector<float> makeGridPositions() {
+    auto row = GRID_SIZE + 1;
+    vector<float> positions;
+    for (uint32_t y = 0; y < row; y++) {
+        for (uint32_t x = 0; x < row; x++) {
+            positions.push_back((float)x);
+            positions.push_back((float)y);
+            positions.push_back(0.f);
+        }
+    }
+    return positions;
+}
+
+// NOTE(jan): Rotated so the lowest index comes first, which keeps the
+// winding.
+static vector<array<uint32_t, 3>> sortedTriangles(
+    const vector<uint32_t>& indices
+) {
+    vector<array<uint32_t, 3>> triangles;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        array<uint32_t, 3> triangle = {
+            indices[i], indices[i+1], indices[i+2]
+        };
+        while (triangle[0] != std::min({
+            triangle[0], triangle[1], triangle[2]
+        })) {
+            std::rotate(triangle.begin(), triangle.begin() + 1, triangle.end());
+        }
+        triangles.push_back(triangle);
+    }
+    std::sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+static void testMeasure() {
+    vector<uint32_t> separate;
+    for (uint32_t i = 0; i < 300; i++) {
+        separate.push_back(i);
+    }
+    auto acmr = measureACMR(separate.data(), separate.size(), 300);
+    check(acmr == 3.f, "triangles without shared vertices should miss 3");
+
+    vector<uint32_t> repeated;
+    for (uint32_t i = 0; i < 100; i++) {
+        for (uint32_t index: { 0, 1, 2 }) {
+            repeated.push_back(index);
+        }
+    }
+    acmr = measureACMR(repeated.data(), repeated.size(), 3);
+    check(acmr == .03f, "a repeated triangle should only miss once");
+}
+
+static void testOptimise() {
+    auto indices = makeShuffledGrid();
+    auto vertexCount = (GRID_SIZE + 1) * (GRID_SIZE + 1);
+    auto positions = makeGridPositions();
+    auto before = sortedTriangles(indices);
+
+    auto shuffled = measureACMR(indices.data(), indices.size(), vertexCount);
+    optimizeVertexCache(indices.data(), indices.size(), vertexCount);
+    auto optimised = measureACMR(indices.data(), indices.size(), vertexCount);
+    check(
+        sortedTriangles(indices) == before,
+        "optimizeVertexCache changed the triangles"
+    );
+
+    optimizeOverdraw(
+        indices.data(),
+        indices.size(),
+        positions.data(),
+        3 * sizeof(float),
+        vertexCount
+    );
+    auto overdraw = measureACMR(indices.data(), indices.size(), vertexCount);
+    check(
+        sortedTriangles(indices) == before,
+        "optimizeOverdraw changed the triangles"
+    );
+
+    printf(
+        "%ux%u grid ACMR: %.3f shuffled, %.3f optimised, %.3f overdraw\n",
+        GRID_SIZE,
+        GRID_SIZE,
+        shuffled,
+        optimised,
+        overdraw
+    );
+    check(shuffled >= MIN_SHUFFLED_ACMR, "shuffled grid ACMR too low");
+    check(optimised <= MAX_OPTIMISED_ACMR, "optimised grid ACMR too high");
+    check(overdraw <= MAX_OVERDRAW_ACMR, "overdraw pass ACMR too high");
+}
+
+int main() {
+    testMeasure();
+    testOptimise();
+    if (failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}